@@ -0,0 +1,65 @@
+#include "FileManager.hpp"
+#include "Piper.hpp"
+
+#include <chrono>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+
+// Compares the real-time factor of the onnxruntime session profiles.
+//
+// Usage: piper-benchmark <model.onnx> [model.onnx.json] [iterations]
+// The config defaults to the bundled test voice config.
+
+using namespace piper;
+
+int main(int argc, char* argv[]) {
+  if (argc < 2)
+  {
+    std::cerr << "Usage: " << argv[0] << " <model.onnx> [model.onnx.json] [iterations]" << std::endl;
+    return 1;
+  }
+
+  std::string modelPath = argv[1];
+  std::string modelConfigPath =
+      (argc > 2) ? argv[2] : (FileManager::getDataSharePath() / "voice-models" / "test_voice.onnx.json").string();
+  int iterations = (argc > 3) ? std::stoi(argv[3]) : 5;
+
+  const char* text = "The quick brown fox jumps over the lazy dog. "
+                     "Piper is a fast, local neural text to speech system, optimized for the Raspberry Pi 4. "
+                     "How long does it take to synthesize a paragraph like this one?";
+
+  spdlog::set_level(spdlog::level::warn);
+
+  std::cout << std::left << std::setw(12) << "profile" << std::setw(12) << "load (s)" << std::setw(12) << "audio (s)"
+            << std::setw(12) << "infer (s)" << "RTF" << std::endl;
+
+  for (const std::string profileName : {"default", "latency", "throughput", "low-memory"})
+  {
+    PiperConfig config;
+    config.voiceOptions.sessionProfile = SessionProfile::fromName(profileName);
+
+    auto loadStart = std::chrono::steady_clock::now();
+    PiperModel piperModel(modelPath, modelConfigPath, config);
+    auto loadEnd = std::chrono::steady_clock::now();
+
+    // Warm up
+    piperModel.textToSpeech(text);
+
+    double audioSeconds = 0.0;
+    double inferSeconds = 0.0;
+    for (int i = 0; i < iterations; i++)
+    {
+      piperModel.textToSpeech(text);
+      audioSeconds += piperModel.getLastSynthesisResult().audioSeconds;
+      inferSeconds += piperModel.getLastSynthesisResult().inferSeconds;
+    }
+
+    std::cout << std::left << std::setw(12) << profileName << std::setw(12)
+              << std::chrono::duration<double>(loadEnd - loadStart).count() << std::setw(12) << audioSeconds
+              << std::setw(12) << inferSeconds << ((audioSeconds > 0) ? (inferSeconds / audioSeconds) : 0.0)
+              << std::endl;
+  }
+
+  return 0;
+}
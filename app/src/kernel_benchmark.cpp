@@ -0,0 +1,121 @@
+#include "audio_kernels.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+// Compares the audio conversion kernels against the original scalar loops.
+//
+// Usage: piper-kernel-benchmark [samples] [iterations]
+// Samples default to 10 seconds of 22050 Hz audio, about one long phrase.
+
+using namespace piper;
+
+namespace {
+
+const float MAX_WAV_VALUE = 32767.0f;
+
+// Loops as they were in Voice before the kernels
+void baselineConvert(const float* audio, std::size_t audioCount, std::vector<int16_t>& audioBuffer) {
+  float maxAudioValue = 0.01f;
+  for (std::size_t i = 0; i < audioCount; i++)
+  {
+    float audioValue = std::abs(audio[i]);
+    if (audioValue > maxAudioValue)
+    {
+      maxAudioValue = audioValue;
+    }
+  }
+
+  audioBuffer.reserve(audioBuffer.size() + audioCount);
+
+  float audioScale = (MAX_WAV_VALUE / std::max(0.01f, maxAudioValue));
+  for (std::size_t i = 0; i < audioCount; i++)
+  {
+    int16_t intAudioValue = static_cast<int16_t>(std::clamp(audio[i] * audioScale,
+                                                            static_cast<float>(std::numeric_limits<int16_t>::min()),
+                                                            static_cast<float>(std::numeric_limits<int16_t>::max())));
+
+    audioBuffer.push_back(intAudioValue);
+  }
+}
+
+void kernelConvert(const AudioKernels& kernels,
+                   const float* audio,
+                   std::size_t audioCount,
+                   std::vector<int16_t>& audioBuffer) {
+  float peak = std::max(0.01f, kernels.peakAbs(audio, audioCount));
+
+  std::size_t offset = audioBuffer.size();
+  audioBuffer.resize(offset + audioCount);
+  kernels.scaleToInt16(audio, audioCount, MAX_WAV_VALUE / peak, audioBuffer.data() + offset);
+}
+
+template <typename Convert>
+double timeConvert(int iterations, std::vector<int16_t>& audioBuffer, Convert convert) {
+  // Warm up
+  audioBuffer.clear();
+  convert(audioBuffer);
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++)
+  {
+    audioBuffer.clear();
+    convert(audioBuffer);
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  return std::chrono::duration<double, std::micro>(end - start).count() / iterations;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  std::size_t sampleCount = (argc > 1) ? std::stoul(argv[1]) : 22050 * 10;
+  int iterations = (argc > 2) ? std::stoi(argv[2]) : 200;
+
+  // Decoder-like output: a few tones with noise, peaking a little under 1
+  std::vector<float> audio(sampleCount);
+  std::mt19937 rng(1234);
+  std::normal_distribution<float> noise(0.0f, 0.02f);
+  for (std::size_t i = 0; i < sampleCount; i++)
+  {
+    float t = static_cast<float>(i) / 22050.0f;
+    audio[i] = 0.4f * std::sin(2.0f * 3.14159265f * 220.0f * t) + 0.3f * std::sin(2.0f * 3.14159265f * 330.0f * t) +
+               noise(rng);
+  }
+
+  std::vector<int16_t> expected;
+  std::vector<int16_t> audioBuffer;
+
+  double baselineMicros = timeConvert(iterations, expected, [&](std::vector<int16_t>& buffer) {
+    baselineConvert(audio.data(), audio.size(), buffer);
+  });
+
+  std::cout << sampleCount << " samples, " << iterations << " iterations, using '" << getAudioKernels().name << "'"
+            << std::endl;
+  std::cout << std::left << std::setw(12) << "kernel" << std::setw(14) << "time (us)" << std::setw(12) << "speedup"
+            << "matches" << std::endl;
+  std::cout << std::left << std::setw(12) << "baseline" << std::setw(14) << baselineMicros << std::setw(12) << 1.0
+            << "-" << std::endl;
+
+  for (const AudioKernels* kernels : getAvailableAudioKernels())
+  {
+    double micros = timeConvert(iterations, audioBuffer, [&](std::vector<int16_t>& buffer) {
+      kernelConvert(*kernels, audio.data(), audio.size(), buffer);
+    });
+
+    std::cout << std::left << std::setw(12) << kernels->name << std::setw(14) << micros << std::setw(12)
+              << ((micros > 0) ? (baselineMicros / micros) : 0.0) << ((audioBuffer == expected) ? "yes" : "no")
+              << std::endl;
+  }
+
+  return 0;
+}
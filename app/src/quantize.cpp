@@ -0,0 +1,278 @@
+#include "Piper.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <spawn.h>
+#include <sys/wait.h>
+
+extern char** environ;
+#endif
+
+// Creates the INT8 dynamically quantized variant of a voice and reports how much it differs from fp32.
+//
+// Usage: piper-quantize <model.onnx> [model.onnx.json]
+//
+// onnxruntime only offers quantization through its Python package, so the quantized model is
+// written by onnxruntime.quantization.quantize_dynamic (pip install onnxruntime).
+// Both models are then run without noise and compared by log-mel spectrogram distance.
+
+using namespace piper;
+
+const int FFT_SIZE = 1024;
+const int HOP_LENGTH = 256;
+const int NUM_MELS = 80;
+
+constexpr float PI = 3.14159265358979323846f;
+
+// Model paths are passed as arguments, never through a shell
+const char* QUANTIZE_SCRIPT = "import sys; from onnxruntime.quantization import quantize_dynamic, QuantType; "
+                              "quantize_dynamic(sys.argv[1], sys.argv[2], weight_type=QuantType.QUInt8)";
+
+// Runs a program found on the PATH and waits for it. Returns its exit code, or -1 if it couldn't be started.
+static int runProgram(const std::vector<std::string>& args) {
+#ifdef _WIN32
+  // _spawnvp joins arguments with spaces; Windows paths can't contain quotes
+  std::vector<std::string> quotedArgs;
+  for (auto const& arg : args)
+  {
+    quotedArgs.push_back("\"" + arg + "\"");
+  }
+
+  std::vector<const char*> argv;
+  for (auto const& arg : quotedArgs)
+  {
+    argv.push_back(arg.c_str());
+  }
+  argv.push_back(nullptr);
+
+  return (int) _spawnvp(_P_WAIT, args[0].c_str(), argv.data());
+#else
+  std::vector<char*> argv;
+  for (auto const& arg : args)
+  {
+    argv.push_back(const_cast<char*>(arg.c_str()));
+  }
+  argv.push_back(nullptr);
+
+  pid_t pid = 0;
+  if (posix_spawnp(&pid, args[0].c_str(), nullptr, nullptr, argv.data(), environ) != 0)
+  {
+    return -1;
+  }
+
+  int status = 0;
+  if ((waitpid(pid, &status, 0) != pid) || !WIFEXITED(status))
+  {
+    return -1;
+  }
+
+  return WEXITSTATUS(status);
+#endif
+}
+
+static void fft(std::vector<std::complex<float>>& values) {
+  std::size_t n = values.size();
+  for (std::size_t i = 1, j = 0; i < n; i++)
+  {
+    std::size_t bit = n >> 1;
+    for (; j & bit; bit >>= 1)
+    {
+      j ^= bit;
+    }
+
+    j ^= bit;
+    if (i < j)
+    {
+      std::swap(values[i], values[j]);
+    }
+  }
+
+  for (std::size_t length = 2; length <= n; length <<= 1)
+  {
+    float angle = -2.0f * PI / length;
+    std::complex<float> step(std::cos(angle), std::sin(angle));
+    for (std::size_t i = 0; i < n; i += length)
+    {
+      std::complex<float> w(1.0f, 0.0f);
+      for (std::size_t k = 0; k < length / 2; k++)
+      {
+        auto even = values[i + k];
+        auto odd = values[i + k + length / 2] * w;
+        values[i + k] = even + odd;
+        values[i + k + length / 2] = even - odd;
+        w *= step;
+      }
+    }
+  }
+}
+
+static float hzToMel(float hz) {
+  return 2595.0f * std::log10(1.0f + hz / 700.0f);
+}
+
+static float melToHz(float mel) {
+  return 700.0f * (std::pow(10.0f, mel / 2595.0f) - 1.0f);
+}
+
+// frames x mels, in dB
+static std::vector<std::vector<float>> logMelSpectrogram(const std::vector<int16_t>& audio, int sampleRate) {
+  // Triangular mel filters
+  int numBins = FFT_SIZE / 2 + 1;
+  std::vector<float> melPoints(NUM_MELS + 2);
+  float maxMel = hzToMel(sampleRate / 2.0f);
+  for (int i = 0; i < NUM_MELS + 2; i++)
+  {
+    melPoints[i] = melToHz(maxMel * i / (NUM_MELS + 1)) * FFT_SIZE / sampleRate;
+  }
+
+  std::vector<std::vector<float>> spectrogram;
+  std::vector<std::complex<float>> frame(FFT_SIZE);
+  for (std::size_t start = 0; start + FFT_SIZE <= audio.size(); start += HOP_LENGTH)
+  {
+    for (int i = 0; i < FFT_SIZE; i++)
+    {
+      float window = 0.5f - 0.5f * std::cos(2.0f * PI * i / FFT_SIZE);
+      frame[i] = std::complex<float>(window * audio[start + i] / 32768.0f, 0.0f);
+    }
+
+    fft(frame);
+
+    std::vector<float> mels(NUM_MELS, 0.0f);
+    for (int mel = 0; mel < NUM_MELS; mel++)
+    {
+      for (int bin = 0; bin < numBins; bin++)
+      {
+        float weight = 0.0f;
+        if ((bin > melPoints[mel]) && (bin <= melPoints[mel + 1]))
+        {
+          weight = (bin - melPoints[mel]) / (melPoints[mel + 1] - melPoints[mel]);
+        }
+        else if ((bin > melPoints[mel + 1]) && (bin < melPoints[mel + 2]))
+        {
+          weight = (melPoints[mel + 2] - bin) / (melPoints[mel + 2] - melPoints[mel + 1]);
+        }
+
+        mels[mel] += weight * std::norm(frame[bin]);
+      }
+
+      mels[mel] = 10.0f * std::log10(std::max(mels[mel], 1e-10f));
+    }
+
+    spectrogram.push_back(std::move(mels));
+  }
+
+  return spectrogram;
+}
+
+// Mean absolute difference in dB over the frames both have
+static double melDistance(const std::vector<std::vector<float>>& a, const std::vector<std::vector<float>>& b) {
+  std::size_t numFrames = std::min(a.size(), b.size());
+  if (numFrames == 0)
+  {
+    return 0.0;
+  }
+
+  double distance = 0.0;
+  for (std::size_t frame = 0; frame < numFrames; frame++)
+  {
+    for (int mel = 0; mel < NUM_MELS; mel++)
+    {
+      distance += std::abs(a[frame][mel] - b[frame][mel]);
+    }
+  }
+
+  return distance / (numFrames * NUM_MELS);
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 2)
+  {
+    std::cerr << "Usage: " << argv[0] << " <model.onnx> [model.onnx.json]" << std::endl;
+    return 1;
+  }
+
+  std::string modelPath = argv[1];
+  std::string modelConfigPath = (argc > 2) ? argv[2] : (modelPath + ".json");
+  std::string quantizedPath = Voice::getQuantizedModelPath(modelPath);
+
+  if (!std::filesystem::exists(quantizedPath))
+  {
+    std::cout << "Quantizing " << modelPath << " to " << quantizedPath << std::endl;
+
+    int exitCode = runProgram({"python3", "-c", QUANTIZE_SCRIPT, modelPath, quantizedPath});
+    if ((exitCode != 0) || !std::filesystem::exists(quantizedPath))
+    {
+      std::cerr << "Quantization failed (is the onnxruntime Python package installed?)" << std::endl;
+      return 1;
+    }
+  }
+
+  const std::vector<std::string> sentences = {
+      "The quick brown fox jumps over the lazy dog.",
+      "It is twenty three degrees and sunny in the city today.",
+      "Your timer for ten minutes has finished.",
+  };
+
+  spdlog::set_level(spdlog::level::warn);
+
+  // Synthesize all sentences with fp32 and INT8
+  std::vector<std::vector<int16_t>> audio[2];
+  double inferSeconds[2] = {0.0, 0.0};
+  double audioSeconds[2] = {0.0, 0.0};
+  int sampleRate = 0;
+  for (int quantized = 0; quantized < 2; quantized++)
+  {
+    PiperConfig config;
+    config.voiceOptions.preferQuantized = (quantized == 1);
+    PiperModel piperModel(modelPath, modelConfigPath, config);
+
+    // Without noise, differences come from quantization only
+    piperModel.getSynthesisConfig().noiseScale = 0.0f;
+    piperModel.getSynthesisConfig().noiseW = 0.0f;
+    sampleRate = piperModel.getSynthesisConfig().sampleRate;
+
+    // Warm up
+    piperModel.textToSpeech(sentences.front());
+
+    for (auto& sentence : sentences)
+    {
+      audio[quantized].push_back(piperModel.textToSpeech(sentence));
+      inferSeconds[quantized] += piperModel.getLastSynthesisResult().inferSeconds;
+      audioSeconds[quantized] += piperModel.getLastSynthesisResult().audioSeconds;
+    }
+  }
+
+  double totalDistance = 0.0;
+  for (std::size_t i = 0; i < sentences.size(); i++)
+  {
+    double distance =
+        melDistance(logMelSpectrogram(audio[0][i], sampleRate), logMelSpectrogram(audio[1][i], sampleRate));
+    long lengthDelta = (long) audio[1][i].size() - (long) audio[0][i].size();
+    std::cout << "\"" << sentences[i] << "\": log-mel distance " << distance << " dB, length delta " << lengthDelta
+              << " sample(s)" << std::endl;
+
+    totalDistance += distance;
+  }
+
+  double rtfFloat = (audioSeconds[0] > 0) ? (inferSeconds[0] / audioSeconds[0]) : 0.0;
+  double rtfQuantized = (audioSeconds[1] > 0) ? (inferSeconds[1] / audioSeconds[1]) : 0.0;
+  std::cout << "Mean log-mel distance: " << (totalDistance / sentences.size()) << " dB" << std::endl;
+  std::cout << "RTF fp32: " << rtfFloat << ", RTF int8: " << rtfQuantized;
+  if (rtfQuantized > 0)
+  {
+    std::cout << " (" << (rtfFloat / rtfQuantized) << "x speed-up)";
+  }
+
+  std::cout << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,195 @@
+#include "AudioCache.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <spdlog/spdlog.h>
+#include <sstream>
+#include <thread>
+
+#include "hash.hpp"
+
+using namespace piper;
+
+namespace {
+
+const char* AUDIO_CACHE_EXTENSION = ".pcm";
+
+// Second hash of the key, so file names are 128 bits
+const uint64_t AUDIO_CACHE_SECOND_BASIS = 0x84222325cbf29ce4ULL;
+
+// Eviction goes below the budget, so it doesn't run again on the next store
+const double AUDIO_CACHE_EVICT_TO = 0.9;
+
+} // namespace
+
+AudioCache::AudioCache(const std::string& directory, uint64_t maxBytes) : m_directory(directory), m_maxBytes(maxBytes) {
+  std::filesystem::create_directories(m_directory);
+
+  std::lock_guard<std::mutex> lock(m_evictMutex);
+  m_estimatedBytes = evict();
+}
+
+std::string AudioCache::getPath(const std::string& key) const {
+  std::string name = hashToHex(fnv1a(key)) + hashToHex(fnv1a(key, AUDIO_CACHE_SECOND_BASIS)) + AUDIO_CACHE_EXTENSION;
+  return (std::filesystem::path(m_directory) / name).string();
+}
+
+std::unique_ptr<MappedFile> AudioCache::find(const std::string& key) {
+  std::string path = getPath(key);
+
+  std::error_code error;
+  if (!std::filesystem::exists(path, error))
+  {
+    m_misses++;
+    return nullptr;
+  }
+
+  std::unique_ptr<MappedFile> mapping;
+  try
+  {
+    mapping = std::make_unique<MappedFile>(path);
+  }
+  catch (const std::exception& e)
+  {
+    // Evicted by another process in the meantime
+    spdlog::debug("Failed to map cached audio {}: {}", path, e.what());
+    m_misses++;
+    return nullptr;
+  }
+
+  // Modification time is the last use for eviction
+  std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), error);
+
+  m_hits++;
+  return mapping;
+}
+
+void AudioCache::store(const std::string& key, const std::vector<int16_t>& audio) {
+  // Empty files can't be mapped
+  if (audio.empty())
+  {
+    return;
+  }
+
+  uint64_t audioBytes = audio.size() * sizeof(int16_t);
+  if (audioBytes > m_maxBytes)
+  {
+    return;
+  }
+
+  std::string path = getPath(key);
+
+  std::stringstream tempName;
+  tempName << path << ".tmp." << std::hash<std::thread::id>{}(std::this_thread::get_id()) << "."
+           << std::chrono::steady_clock::now().time_since_epoch().count();
+  std::string tempPath = tempName.str();
+
+  {
+    std::ofstream tempFile(tempPath, std::ios::binary);
+    tempFile.write(reinterpret_cast<const char*>(audio.data()), audioBytes);
+    if (!tempFile)
+    {
+      spdlog::warn("Failed to write cached audio {}", tempPath);
+      tempFile.close();
+
+      std::error_code error;
+      std::filesystem::remove(tempPath, error);
+      return;
+    }
+  }
+
+  // Readers either see the complete file or none at all
+  std::error_code renameError;
+  std::filesystem::rename(tempPath, path, renameError);
+  if (renameError)
+  {
+    spdlog::warn("Failed to cache audio at {}: {}", path, renameError.message());
+    std::filesystem::remove(tempPath, renameError);
+    return;
+  }
+
+  m_stores++;
+
+  std::lock_guard<std::mutex> lock(m_evictMutex);
+  m_estimatedBytes += audioBytes;
+  if (m_estimatedBytes > m_maxBytes)
+  {
+    m_estimatedBytes = evict();
+  }
+}
+
+// Removes the least recently used files until the directory fits the budget again.
+// Returns the size of the remaining files.
+uint64_t AudioCache::evict() {
+  struct CachedFile
+  {
+    std::filesystem::path path;
+    std::filesystem::file_time_type lastUsed;
+    uint64_t size;
+  };
+
+  std::vector<CachedFile> cachedFiles;
+  uint64_t totalBytes = 0;
+
+  std::error_code error;
+  for (auto const& entry : std::filesystem::directory_iterator(m_directory, error))
+  {
+    // Skips temporary files of stores in progress
+    if (!entry.is_regular_file(error) || (entry.path().extension() != AUDIO_CACHE_EXTENSION))
+    {
+      continue;
+    }
+
+    CachedFile cachedFile{entry.path(), entry.last_write_time(error), entry.file_size(error)};
+    if (!error)
+    {
+      totalBytes += cachedFile.size;
+      cachedFiles.push_back(std::move(cachedFile));
+    }
+  }
+
+  if (totalBytes <= m_maxBytes)
+  {
+    return totalBytes;
+  }
+
+  std::sort(cachedFiles.begin(), cachedFiles.end(), [](const CachedFile& a, const CachedFile& b) {
+    return a.lastUsed < b.lastUsed;
+  });
+
+  auto targetBytes = static_cast<uint64_t>(m_maxBytes * AUDIO_CACHE_EVICT_TO);
+  for (auto const& cachedFile : cachedFiles)
+  {
+    if (totalBytes <= targetBytes)
+    {
+      break;
+    }
+
+    // Another process may have removed it already; a mapped file may not be removable on Windows
+    if (std::filesystem::remove(cachedFile.path, error))
+    {
+      m_evictions++;
+    }
+
+    if (!error)
+    {
+      totalBytes -= cachedFile.size;
+    }
+  }
+
+  spdlog::debug("Audio cache at {} holds {} byte(s) after eviction", m_directory, totalBytes);
+  return totalBytes;
+}
+
+AudioCacheStats AudioCache::getStats() const {
+  AudioCacheStats stats;
+  stats.hits = m_hits;
+  stats.misses = m_misses;
+  stats.stores = m_stores;
+  stats.evictions = m_evictions;
+
+  return stats;
+}
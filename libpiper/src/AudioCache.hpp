@@ -0,0 +1,59 @@
+#ifndef AUDIO_CACHE_H
+#define AUDIO_CACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "MappedFile.hpp"
+
+namespace piper {
+
+struct AudioCacheStats
+{
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  uint64_t stores = 0;
+  uint64_t evictions = 0;
+};
+
+// Synthesized int16 audio stored on disk, one file per key, named by the key.
+// Files are written to a temporary name and renamed into place, so processes on one host can share a directory.
+// When the directory grows over its budget, the least recently used files (by modification time) are removed.
+class AudioCache
+{
+public:
+  AudioCache(const std::string& directory, uint64_t maxBytes);
+
+  // Memory mapping of the cached samples (native byte order), or nullptr on a miss
+  std::unique_ptr<MappedFile> find(const std::string& key);
+
+  void store(const std::string& key, const std::vector<int16_t>& audio);
+
+  AudioCacheStats getStats() const;
+
+  const std::string& getDirectory() const { return m_directory; }
+
+private:
+  std::string m_directory;
+  uint64_t m_maxBytes;
+
+  // Size of the directory at the last scan plus what this process stored since
+  std::mutex m_evictMutex;
+  uint64_t m_estimatedBytes = 0;
+
+  std::atomic<uint64_t> m_hits{0};
+  std::atomic<uint64_t> m_misses{0};
+  std::atomic<uint64_t> m_stores{0};
+  std::atomic<uint64_t> m_evictions{0};
+
+  std::string getPath(const std::string& key) const;
+  uint64_t evict();
+};
+
+} // namespace piper
+
+#endif // AUDIO_CACHE_H
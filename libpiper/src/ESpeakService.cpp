@@ -0,0 +1,190 @@
+#include "ESpeakService.hpp"
+
+#include <espeak-ng/speak_lib.h>
+#include <limits>
+#include <mutex>
+#include <spdlog/spdlog.h>
+#include <stdexcept>
+
+using namespace piper;
+
+namespace {
+
+// Guards the shared instance; held while it starts and stops,
+// so a new instance never initializes eSpeak while an old one is terminating it
+std::mutex instanceMutex;
+std::unique_ptr<ESpeakService> instance;
+std::size_t numUsers = 0;
+
+// Queues never block the eSpeak thread
+const std::size_t UNBOUNDED = std::numeric_limits<std::size_t>::max();
+
+} // namespace
+
+struct ESpeakService::Job
+{
+  std::string text;
+  eSpeakPhonemeConfig config;
+
+  // Set for batch jobs instead of text, which have no clause stream
+  std::vector<PhonemizeRequest>* batch = nullptr;
+  std::vector<std::vector<std::vector<Phoneme>>>* batchPhonemes = nullptr;
+
+  // Closed by the eSpeak thread when done, or by the caller to stop early
+  BoundedQueue<std::vector<Phoneme>> clauses{UNBOUNDED};
+  std::exception_ptr error;
+};
+
+std::shared_ptr<ESpeakService> ESpeakService::acquire(const std::string& dataPath) {
+  std::lock_guard<std::mutex> lock(instanceMutex);
+  if (!instance)
+  {
+    instance.reset(new ESpeakService(dataPath));
+  }
+  else if (instance->m_dataPath != dataPath)
+  {
+    spdlog::warn("eSpeak is already using data at {}, ignoring {}", instance->m_dataPath, dataPath);
+  }
+
+  numUsers++;
+  return std::shared_ptr<ESpeakService>(instance.get(), [](ESpeakService*) { release(); });
+}
+
+void ESpeakService::release() {
+  std::lock_guard<std::mutex> lock(instanceMutex);
+  numUsers--;
+  if (numUsers == 0)
+  {
+    instance.reset();
+  }
+}
+
+std::size_t ESpeakService::getNumUsers() {
+  std::lock_guard<std::mutex> lock(instanceMutex);
+  return numUsers;
+}
+
+ESpeakService::ESpeakService(const std::string& dataPath) : m_dataPath(dataPath), m_jobs(UNBOUNDED) {
+  std::promise<void> initialized;
+  std::future<void> initResult = initialized.get_future();
+  m_thread = std::thread([this, &initialized]() { run(initialized); });
+
+  try
+  {
+    initResult.get();
+  }
+  catch (...)
+  {
+    m_thread.join();
+    throw;
+  }
+}
+
+ESpeakService::~ESpeakService() {
+  // Jobs already queued still run
+  m_jobs.close();
+  m_thread.join();
+}
+
+void ESpeakService::run(std::promise<void>& initialized) {
+  // Set up espeak-ng for calling espeak_TextToPhonemesWithTerminator
+  // See: https://github.com/rhasspy/espeak-ng
+  spdlog::debug("Initializing eSpeak");
+  int result = espeak_Initialize(AUDIO_OUTPUT_SYNCHRONOUS, 0, m_dataPath.c_str(), 0);
+  if (result < 0)
+  {
+    initialized.set_exception(std::make_exception_ptr(std::runtime_error("Failed to initialize eSpeak-ng")));
+    return;
+  }
+
+  // A new instance starts without a voice
+  resetESpeakVoice();
+
+  spdlog::debug("Initialized eSpeak");
+  initialized.set_value();
+
+  std::shared_ptr<Job> job;
+  while (m_jobs.pop(job))
+  {
+    try
+    {
+      if (job->batch)
+      {
+        phonemizeBatch_eSpeak(*job->batch, *job->batchPhonemes);
+      }
+      else
+      {
+        // push fails once the caller has stopped listening
+        phonemize_eSpeak(job->text, job->config, [&job](std::vector<Phoneme>& sentencePhonemes) {
+          return job->clauses.push(std::move(sentencePhonemes));
+        });
+      }
+    }
+    catch (...)
+    {
+      job->error = std::current_exception();
+    }
+
+    job->clauses.close();
+    job.reset();
+  }
+
+  spdlog::debug("Terminating eSpeak");
+  espeak_Terminate();
+  spdlog::debug("Terminated eSpeak");
+}
+
+void ESpeakService::phonemize(const std::string& text,
+                              eSpeakPhonemeConfig& config,
+                              const std::function<bool(std::vector<Phoneme>&)>& clauseCallback) {
+  auto job = std::make_shared<Job>();
+  job->text = text;
+  job->config = config;
+  m_jobs.push(job);
+
+  std::vector<Phoneme> sentencePhonemes;
+  while (job->clauses.pop(sentencePhonemes))
+  {
+    bool keepGoing = false;
+    try
+    {
+      keepGoing = clauseCallback(sentencePhonemes);
+    }
+    catch (...)
+    {
+      job->clauses.close();
+      throw;
+    }
+
+    if (!keepGoing)
+    {
+      job->clauses.close();
+      return;
+    }
+  }
+
+  // The eSpeak thread set the error before closing the queue
+  if (job->error)
+  {
+    std::rethrow_exception(job->error);
+  }
+}
+
+void ESpeakService::phonemizeBatch(std::vector<PhonemizeRequest>& requests,
+                                   std::vector<std::vector<std::vector<Phoneme>>>& phonemes) {
+  auto job = std::make_shared<Job>();
+  job->batch = &requests;
+  job->batchPhonemes = &phonemes;
+  m_jobs.push(job);
+
+  // Closed when the batch is done
+  std::vector<Phoneme> unused;
+  while (job->clauses.pop(unused))
+  {
+  }
+
+  if (job->error)
+  {
+    std::rethrow_exception(job->error);
+  }
+}
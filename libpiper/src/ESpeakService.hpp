@@ -0,0 +1,63 @@
+#ifndef ESPEAK_SERVICE_H
+#define ESPEAK_SERVICE_H
+
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BoundedQueue.hpp"
+#include "phonemize.hpp"
+
+namespace piper {
+
+// Process-wide owner of espeak-ng, which keeps global state.
+// eSpeak is initialized once for all users and terminated when the last one releases it.
+// Phonemization requests of all users run one at a time on a dedicated thread,
+// while the clause callbacks run on the calling threads.
+class ESpeakService
+{
+public:
+  // Starts the service on first use; later users share it.
+  // The data path of the first user wins.
+  static std::shared_ptr<ESpeakService> acquire(const std::string& dataPath);
+
+  // Number of users holding the service
+  static std::size_t getNumUsers();
+
+  ~ESpeakService();
+
+  ESpeakService(const ESpeakService&) = delete;
+  ESpeakService& operator=(const ESpeakService&) = delete;
+
+  // Same contract as phonemize_eSpeak: the callback gets each clause's phonemes as soon as they are ready
+  // and may return false to stop. Errors from eSpeak are rethrown on the calling thread.
+  void phonemize(const std::string& text,
+                 eSpeakPhonemeConfig& config,
+                 const std::function<bool(std::vector<Phoneme>&)>& clauseCallback);
+
+  // Runs phonemizeBatch_eSpeak as one job, so other users' texts don't switch voices in between
+  void phonemizeBatch(std::vector<PhonemizeRequest>& requests,
+                      std::vector<std::vector<std::vector<Phoneme>>>& phonemes);
+
+  const std::string& getDataPath() const { return m_dataPath; }
+
+private:
+  struct Job;
+
+  explicit ESpeakService(const std::string& dataPath);
+  static void release();
+
+  void run(std::promise<void>& initialized);
+
+  std::string m_dataPath;
+  BoundedQueue<std::shared_ptr<Job>> m_jobs;
+  std::thread m_thread;
+};
+
+} // namespace piper
+
+#endif // ESPEAK_SERVICE_H
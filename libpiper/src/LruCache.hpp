@@ -0,0 +1,126 @@
+#ifndef LRU_CACHE_H
+#define LRU_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+namespace piper {
+
+struct CacheStats
+{
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  uint64_t evictions = 0;
+  std::size_t entries = 0;
+  std::size_t bytes = 0;
+};
+
+// Thread-safe least recently used cache, bounded by the total size of its entries.
+// Values are immutable and shared, so a hit doesn't copy them under the lock.
+template <typename Key, typename Value, typename Hash = std::hash<Key>>
+class LruCache
+{
+public:
+  explicit LruCache(std::size_t maxBytes) : m_maxBytes(maxBytes) {}
+
+  LruCache(const LruCache&) = delete;
+  LruCache& operator=(const LruCache&) = delete;
+
+  // nullptr on a miss. Callers probing several keys for one lookup only count the miss of the last.
+  std::shared_ptr<const Value> get(const Key& key, bool countMiss = true) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_index.find(key);
+    if (it == m_index.end())
+    {
+      if (countMiss)
+      {
+        m_stats.misses++;
+      }
+
+      return nullptr;
+    }
+
+    // Move to front (most recently used)
+    m_entries.splice(m_entries.begin(), m_entries, it->second);
+    m_stats.hits++;
+
+    return it->second->value;
+  }
+
+  // bytes is the caller's estimate of the entry's size, including the key.
+  // Entries larger than the whole cache are not stored.
+  void put(const Key& key, std::shared_ptr<const Value> value, std::size_t bytes) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (bytes > m_maxBytes)
+    {
+      return;
+    }
+
+    auto it = m_index.find(key);
+    if (it != m_index.end())
+    {
+      m_stats.bytes -= it->second->bytes;
+      m_entries.erase(it->second);
+      m_index.erase(it);
+    }
+
+    m_entries.push_front(Entry{key, std::move(value), bytes});
+    m_index.emplace(key, m_entries.begin());
+    m_stats.bytes += bytes;
+
+    while (m_stats.bytes > m_maxBytes)
+    {
+      evictLast();
+    }
+
+    m_stats.entries = m_entries.size();
+  }
+
+  void clear() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries.clear();
+    m_index.clear();
+    m_stats.entries = 0;
+    m_stats.bytes = 0;
+  }
+
+  CacheStats getStats() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+  }
+
+  std::size_t getMaxBytes() const { return m_maxBytes; }
+
+private:
+  struct Entry
+  {
+    Key key;
+    std::shared_ptr<const Value> value;
+    std::size_t bytes;
+  };
+
+  std::size_t m_maxBytes;
+  std::list<Entry> m_entries;
+  std::unordered_map<Key, typename std::list<Entry>::iterator, Hash> m_index;
+  CacheStats m_stats;
+  std::mutex m_mutex;
+
+  void evictLast() {
+    Entry& last = m_entries.back();
+    m_stats.bytes -= last.bytes;
+    m_stats.evictions++;
+    m_index.erase(last.key);
+    m_entries.pop_back();
+  }
+};
+
+} // namespace piper
+
+#endif // LRU_CACHE_H
@@ -0,0 +1,92 @@
+#include "MappedFile.hpp"
+
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace piper;
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& path) : m_path(path) {
+  HANDLE file =
+      CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+  {
+    throw std::runtime_error("Failed to open " + path);
+  }
+
+  LARGE_INTEGER fileSize;
+  if (!GetFileSizeEx(file, &fileSize))
+  {
+    CloseHandle(file);
+    throw std::runtime_error("Failed to get size of " + path);
+  }
+
+  HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (mapping == nullptr)
+  {
+    CloseHandle(file);
+    throw std::runtime_error("Failed to map " + path);
+  }
+
+  m_data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (m_data == nullptr)
+  {
+    CloseHandle(mapping);
+    CloseHandle(file);
+    throw std::runtime_error("Failed to map " + path);
+  }
+
+  m_file = file;
+  m_mapping = mapping;
+  m_size = static_cast<std::size_t>(fileSize.QuadPart);
+}
+
+MappedFile::~MappedFile() {
+  UnmapViewOfFile(m_data);
+  CloseHandle(m_mapping);
+  CloseHandle(m_file);
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& path) : m_path(path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+  {
+    throw std::runtime_error("Failed to open " + path);
+  }
+
+  struct stat fileStat;
+  if ((fstat(fd, &fileStat) != 0) || (fileStat.st_size <= 0))
+  {
+    close(fd);
+    throw std::runtime_error("Failed to get size of " + path);
+  }
+
+  m_size = static_cast<std::size_t>(fileStat.st_size);
+  m_data = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+
+  // Mapping stays valid after the descriptor is closed
+  close(fd);
+
+  if (m_data == MAP_FAILED)
+  {
+    m_data = nullptr;
+    throw std::runtime_error("Failed to map " + path);
+  }
+}
+
+MappedFile::~MappedFile() {
+  munmap(m_data, m_size);
+}
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+namespace piper {
+
+// Read-only memory mapping of a whole file.
+// Pages are backed by the page cache, so processes mapping the same file share them.
+class MappedFile
+{
+public:
+  explicit MappedFile(const std::string& path);
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const void* data() const { return m_data; }
+  std::size_t size() const { return m_size; }
+  const std::string& path() const { return m_path; }
+
+private:
+  std::string m_path;
+  void* m_data = nullptr;
+  std::size_t m_size = 0;
+
+#ifdef _WIN32
+  void* m_file = nullptr;
+  void* m_mapping = nullptr;
+#endif
+};
+
+} // namespace piper
+
+#endif // MAPPED_FILE_H
@@ -0,0 +1,65 @@
+#include "OrtRuntime.hpp"
+
+#include <spdlog/spdlog.h>
+
+using namespace piper;
+
+std::mutex OrtRuntime::s_mutex;
+RuntimeConfig OrtRuntime::s_config;
+std::unique_ptr<Ort::Env> OrtRuntime::s_env;
+
+void OrtRuntime::configure(const RuntimeConfig& config) {
+  std::lock_guard<std::mutex> lock(s_mutex);
+  if (s_env)
+  {
+    spdlog::warn("onnxruntime environment is already in use; runtime config is ignored");
+    return;
+  }
+
+  s_config = config;
+}
+
+Ort::Env& OrtRuntime::getEnv() {
+  std::lock_guard<std::mutex> lock(s_mutex);
+  if (!s_env)
+  {
+    if (s_config.globalThreadPools)
+    {
+      spdlog::debug("Creating onnxruntime environment with global thread pools (intra-op: {}, inter-op: {})",
+                    s_config.intraOpThreads,
+                    s_config.interOpThreads);
+
+      Ort::ThreadingOptions threadingOptions;
+      threadingOptions.SetGlobalIntraOpNumThreads(s_config.intraOpThreads);
+      threadingOptions.SetGlobalInterOpNumThreads(s_config.interOpThreads);
+      threadingOptions.SetGlobalSpinControl(s_config.allowSpinning ? 1 : 0);
+      if (s_config.denormalAsZero)
+      {
+        threadingOptions.SetGlobalDenormalAsZero();
+      }
+
+      s_env = std::make_unique<Ort::Env>(threadingOptions, OrtLoggingLevel::ORT_LOGGING_LEVEL_WARNING, "piper");
+    }
+    else
+    {
+      spdlog::debug("Creating onnxruntime environment");
+      s_env = std::make_unique<Ort::Env>(OrtLoggingLevel::ORT_LOGGING_LEVEL_WARNING, "piper");
+    }
+
+    s_env->DisableTelemetryEvents();
+  }
+
+  return *s_env;
+}
+
+bool OrtRuntime::usesGlobalThreadPools() {
+  std::lock_guard<std::mutex> lock(s_mutex);
+  return s_config.globalThreadPools;
+}
+
+void OrtRuntime::prepareSessionOptions(Ort::SessionOptions& options) {
+  if (usesGlobalThreadPools())
+  {
+    options.DisablePerSessionThreads();
+  }
+}
@@ -0,0 +1,47 @@
+#ifndef ORT_RUNTIME_H
+#define ORT_RUNTIME_H
+
+#include <memory>
+#include <mutex>
+#include <onnxruntime_cxx_api.h>
+
+namespace piper {
+
+struct RuntimeConfig
+{
+  // Run all sessions on one process-wide intra-op/inter-op thread pool.
+  // Per-session thread settings of the session profiles are ignored then.
+  bool globalThreadPools = true;
+
+  // 0 lets onnxruntime decide
+  int intraOpThreads = 0;
+  int interOpThreads = 0;
+
+  bool allowSpinning = true;
+  bool denormalAsZero = false;
+};
+
+// Process-wide onnxruntime environment shared by every voice and the tashkeel model.
+// With the default global thread pools, the number of runtime threads stays bounded no matter how many voices
+// are loaded. Configure it through VoiceOptions::runtimeConfig of the first voice, or configure() before that.
+class OrtRuntime
+{
+public:
+  // Only takes effect before the environment is first used
+  static void configure(const RuntimeConfig& config);
+
+  static Ort::Env& getEnv();
+  static bool usesGlobalThreadPools();
+
+  // Attach session to the global thread pools (if enabled)
+  static void prepareSessionOptions(Ort::SessionOptions& options);
+
+private:
+  static std::mutex s_mutex;
+  static RuntimeConfig s_config;
+  static std::unique_ptr<Ort::Env> s_env;
+};
+
+} // namespace piper
+
+#endif // ORT_RUNTIME_H
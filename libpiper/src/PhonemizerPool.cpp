@@ -0,0 +1,694 @@
+#include "PhonemizerPool.hpp"
+
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <espeak-ng/speak_lib.h>
+#include <functional>
+#include <new>
+#include <pthread.h>
+#include <spdlog/spdlog.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#endif
+
+using namespace piper;
+
+#ifdef _WIN32
+
+struct PhonemizerPool::Worker
+{
+};
+
+PhonemizerPool::PhonemizerPool(const std::string&, std::size_t, std::size_t) {
+  throw std::runtime_error("PhonemizerPool is not supported on Windows");
+}
+
+PhonemizerPool::~PhonemizerPool() {}
+
+void PhonemizerPool::phonemize(const std::string&, eSpeakPhonemeConfig&, const ClauseCallback&) {
+  throw std::runtime_error("PhonemizerPool is not supported on Windows");
+}
+
+std::size_t PhonemizerPool::getNumWorkers() const { return 0; }
+
+VoiceSwitchStats PhonemizerPool::getVoiceSwitchStats() const { return VoiceSwitchStats(); }
+
+#else
+
+namespace {
+
+// Request types
+const uint32_t REQUEST_QUIT = 0;
+const uint32_t REQUEST_PHONEMIZE = 1;
+
+// A clause is sent as its phonemes followed by the number of bytes of text eSpeak read for it.
+// These are sent in place of a clause's phoneme count.
+const uint32_t RESPONSE_END = 0xFFFFFFFF;
+const uint32_t RESPONSE_ERROR = 0xFFFFFFFE;
+
+// How often a blocked read or write checks that the other process is still alive
+const long PEER_CHECK_NANOSECONDS = 100 * 1000 * 1000;
+
+// Time a worker gets to quit before it is terminated
+const int QUIT_CHECKS = 100;
+const std::chrono::milliseconds QUIT_CHECK_INTERVAL(10);
+
+// Lives in shared memory; positions only grow, the data index is position % capacity
+struct RingHeader
+{
+  pthread_mutex_t mutex;
+  pthread_cond_t notEmpty;
+  pthread_cond_t notFull;
+
+  uint64_t readPosition;
+  uint64_t writePosition;
+};
+
+// Start of each worker's shared memory, followed by the request and response data
+struct SharedChannel
+{
+  // Set by the parent to stop the worker after its current clause
+  std::atomic<uint32_t> cancelled;
+
+  RingHeader request;
+  RingHeader response;
+};
+
+void initRingHeader(RingHeader& header) {
+  pthread_mutexattr_t mutexAttr;
+  pthread_mutexattr_init(&mutexAttr);
+  pthread_mutexattr_setpshared(&mutexAttr, PTHREAD_PROCESS_SHARED);
+
+  // A process dying while holding the lock doesn't block the other one forever
+  pthread_mutexattr_setrobust(&mutexAttr, PTHREAD_MUTEX_ROBUST);
+  pthread_mutex_init(&header.mutex, &mutexAttr);
+  pthread_mutexattr_destroy(&mutexAttr);
+
+  pthread_condattr_t condAttr;
+  pthread_condattr_init(&condAttr);
+  pthread_condattr_setpshared(&condAttr, PTHREAD_PROCESS_SHARED);
+  pthread_cond_init(&header.notEmpty, &condAttr);
+  pthread_cond_init(&header.notFull, &condAttr);
+  pthread_condattr_destroy(&condAttr);
+
+  header.readPosition = 0;
+  header.writePosition = 0;
+}
+
+class RingLock
+{
+public:
+  explicit RingLock(pthread_mutex_t& mutex) : m_mutex(mutex) {
+    if (pthread_mutex_lock(&m_mutex) == EOWNERDEAD)
+    {
+      // The peer check of the next wait reports the dead process
+      pthread_mutex_consistent(&m_mutex);
+    }
+  }
+
+  ~RingLock() { pthread_mutex_unlock(&m_mutex); }
+
+  RingLock(const RingLock&) = delete;
+  RingLock& operator=(const RingLock&) = delete;
+
+private:
+  pthread_mutex_t& m_mutex;
+};
+
+// Byte stream from one process to another over a ring in shared memory.
+// Messages may be larger than the ring; the writer blocks until the reader makes room.
+class SharedRing
+{
+public:
+  SharedRing(RingHeader& header, char* data, std::size_t capacity, std::function<bool()> peerAlive)
+      : m_header(header), m_data(data), m_capacity(capacity), m_peerAlive(std::move(peerAlive)) {}
+
+  void write(const void* bytes, std::size_t size) {
+    const char* source = static_cast<const char*>(bytes);
+    while (size > 0)
+    {
+      RingLock lock(m_header.mutex);
+      while (m_header.writePosition - m_header.readPosition == m_capacity)
+      {
+        wait(m_header.notFull);
+      }
+
+      std::size_t free = m_capacity - (m_header.writePosition - m_header.readPosition);
+      std::size_t offset = m_header.writePosition % m_capacity;
+      std::size_t chunk = std::min({size, free, m_capacity - offset});
+
+      std::memcpy(m_data + offset, source, chunk);
+      m_header.writePosition += chunk;
+      pthread_cond_signal(&m_header.notEmpty);
+
+      source += chunk;
+      size -= chunk;
+    }
+  }
+
+  void write(const std::string& message) { write(message.data(), message.size()); }
+
+  void read(void* bytes, std::size_t size) {
+    char* target = static_cast<char*>(bytes);
+    while (size > 0)
+    {
+      RingLock lock(m_header.mutex);
+      while (m_header.writePosition == m_header.readPosition)
+      {
+        wait(m_header.notEmpty);
+      }
+
+      std::size_t available = m_header.writePosition - m_header.readPosition;
+      std::size_t offset = m_header.readPosition % m_capacity;
+      std::size_t chunk = std::min({size, available, m_capacity - offset});
+
+      std::memcpy(target, m_data + offset, chunk);
+      m_header.readPosition += chunk;
+      pthread_cond_signal(&m_header.notFull);
+
+      target += chunk;
+      size -= chunk;
+    }
+  }
+
+private:
+  // Must hold the lock
+  void wait(pthread_cond_t& condition) {
+    timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += PEER_CHECK_NANOSECONDS;
+    if (deadline.tv_nsec >= 1000 * 1000 * 1000)
+    {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000 * 1000 * 1000;
+    }
+
+    int result = pthread_cond_timedwait(&condition, &m_header.mutex, &deadline);
+    if (result == EOWNERDEAD)
+    {
+      pthread_mutex_consistent(&m_header.mutex);
+    }
+
+    if ((result != 0) && !m_peerAlive())
+    {
+      throw std::runtime_error("Phonemizer process is gone");
+    }
+  }
+
+  RingHeader& m_header;
+  char* m_data;
+  std::size_t m_capacity;
+  std::function<bool()> m_peerAlive;
+};
+
+void putU32(std::string& message, uint32_t value) { message.append(reinterpret_cast<const char*>(&value), sizeof(value)); }
+
+void putString(std::string& message, const std::string& value) {
+  putU32(message, static_cast<uint32_t>(value.size()));
+  message.append(value);
+}
+
+void putPhonemes(std::string& message, const std::vector<Phoneme>& phonemes) {
+  putU32(message, static_cast<uint32_t>(phonemes.size()));
+  message.append(reinterpret_cast<const char*>(phonemes.data()), phonemes.size() * sizeof(Phoneme));
+}
+
+uint32_t readU32(SharedRing& ring) {
+  uint32_t value = 0;
+  ring.read(&value, sizeof(value));
+  return value;
+}
+
+std::string readString(SharedRing& ring) {
+  std::string value(readU32(ring), '\0');
+  ring.read(&value[0], value.size());
+  return value;
+}
+
+void readPhonemes(SharedRing& ring, uint32_t numPhonemes, std::vector<Phoneme>& phonemes) {
+  phonemes.resize(numPhonemes);
+  ring.read(phonemes.data(), numPhonemes * sizeof(Phoneme));
+}
+
+std::vector<Phoneme> readPhonemes(SharedRing& ring) {
+  std::vector<Phoneme> phonemes;
+  readPhonemes(ring, readU32(ring), phonemes);
+  return phonemes;
+}
+
+// Everything in the config except the cache, which stays with the parent
+std::string encodeRequest(const std::string& text, const eSpeakPhonemeConfig& config) {
+  std::string message;
+  putU32(message, REQUEST_PHONEMIZE);
+  putString(message, text);
+  putString(message, config.voice);
+  putU32(message, config.keepLanguageFlags ? 1 : 0);
+
+  for (Phoneme phoneme : {config.period, config.comma, config.question, config.exclamation, config.colon,
+                          config.semicolon, config.space})
+  {
+    putU32(message, phoneme);
+  }
+
+  putU32(message, config.phonemeMap ? static_cast<uint32_t>(config.phonemeMap->size()) : 0);
+  if (config.phonemeMap)
+  {
+    for (auto const& mapping : *config.phonemeMap)
+    {
+      putU32(message, mapping.first);
+      putPhonemes(message, mapping.second);
+    }
+  }
+
+  return message;
+}
+
+// Reads the rest of a request after its type
+void decodeRequest(SharedRing& ring, std::string& text, eSpeakPhonemeConfig& config) {
+  text = readString(ring);
+  config.voice = readString(ring);
+  config.keepLanguageFlags = (readU32(ring) != 0);
+
+  for (Phoneme* phoneme : {&config.period, &config.comma, &config.question, &config.exclamation, &config.colon,
+                           &config.semicolon, &config.space})
+  {
+    *phoneme = readU32(ring);
+  }
+
+  uint32_t numMappings = readU32(ring);
+  config.phonemeMap.reset();
+  if (numMappings > 0)
+  {
+    config.phonemeMap = std::make_shared<PhonemeMap>();
+    for (uint32_t i = 0; i < numMappings; i++)
+    {
+      Phoneme from = readU32(ring);
+      (*config.phonemeMap)[from] = readPhonemes(ring);
+    }
+  }
+}
+
+// Main loop of a worker process. Never returns.
+// The first response reports whether eSpeak initialized.
+[[noreturn]] void runWorker(const std::string& dataPath,
+                            SharedChannel& channel,
+                            SharedRing& requests,
+                            SharedRing& responses) {
+  try
+  {
+    std::string message;
+    if (espeak_Initialize(AUDIO_OUTPUT_SYNCHRONOUS, 0, dataPath.c_str(), 0) < 0)
+    {
+      putU32(message, RESPONSE_ERROR);
+      putString(message, "Failed to initialize eSpeak-ng");
+      responses.write(message);
+      _exit(1);
+    }
+
+    // The voice selected by the parent's eSpeak was copied by fork, but isn't loaded here
+    resetESpeakVoice();
+
+    putU32(message, RESPONSE_END);
+    responses.write(message);
+
+    std::string text;
+    eSpeakPhonemeConfig config;
+    while (readU32(requests) == REQUEST_PHONEMIZE)
+    {
+      decodeRequest(requests, text, config);
+
+      message.clear();
+      try
+      {
+        phonemizeUncached_eSpeak(text, config, [&](std::vector<Phoneme>& sentencePhonemes, std::size_t textBytes) {
+          if (channel.cancelled.load())
+          {
+            return false;
+          }
+
+          message.clear();
+          putPhonemes(message, sentencePhonemes);
+          putU32(message, static_cast<uint32_t>(textBytes));
+          responses.write(message);
+          return true;
+        });
+
+        message.clear();
+        putU32(message, RESPONSE_END);
+      }
+      catch (const std::exception& e)
+      {
+        message.clear();
+        putU32(message, RESPONSE_ERROR);
+        putString(message, e.what());
+      }
+
+      responses.write(message);
+    }
+
+    espeak_Terminate();
+    _exit(0);
+  }
+  catch (...)
+  {
+    // The parent is gone
+    _exit(1);
+  }
+}
+
+} // namespace
+
+struct PhonemizerPool::Worker
+{
+  pid_t pid = -1;
+  bool exited = false;
+
+  // Voice of the last request, which stays loaded in the worker's eSpeak
+  std::string voice;
+
+  void* shared = MAP_FAILED;
+  std::size_t sharedBytes = 0;
+  SharedChannel* channel = nullptr;
+
+  std::unique_ptr<SharedRing> requests;
+  std::unique_ptr<SharedRing> responses;
+
+  ~Worker() {
+    if (shared != MAP_FAILED)
+    {
+      munmap(shared, sharedBytes);
+    }
+  }
+
+  bool isAlive() {
+    if (!exited)
+    {
+      int status = 0;
+      pid_t result = waitpid(pid, &status, WNOHANG);
+      exited = (result == pid) || (result < 0);
+    }
+
+    return !exited;
+  }
+
+  void kill() {
+    if (!exited)
+    {
+      ::kill(pid, SIGKILL);
+      int status = 0;
+      waitpid(pid, &status, 0);
+      exited = true;
+    }
+  }
+};
+
+PhonemizerPool::PhonemizerPool(const std::string& dataPath, std::size_t numWorkers, std::size_t ringBytes) {
+  if (ringBytes == 0)
+  {
+    throw std::runtime_error("Phonemizer ring size must be positive");
+  }
+
+  if (numWorkers == 0)
+  {
+    numWorkers = std::max(1U, std::thread::hardware_concurrency());
+  }
+
+  pid_t parentPid = getpid();
+
+  try
+  {
+    for (std::size_t i = 0; i < numWorkers; i++)
+    {
+      auto worker = std::make_unique<Worker>();
+      worker->sharedBytes = sizeof(SharedChannel) + (2 * ringBytes);
+      worker->shared =
+          mmap(nullptr, worker->sharedBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+      if (worker->shared == MAP_FAILED)
+      {
+        throw std::runtime_error("Failed to map shared memory for phonemizer: " + std::string(std::strerror(errno)));
+      }
+
+      SharedChannel* channel = new (worker->shared) SharedChannel();
+      channel->cancelled = 0;
+      initRingHeader(channel->request);
+      initRingHeader(channel->response);
+      worker->channel = channel;
+
+      char* requestData = static_cast<char*>(worker->shared) + sizeof(SharedChannel);
+      char* responseData = requestData + ringBytes;
+
+      pid_t pid = fork();
+      if (pid < 0)
+      {
+        throw std::runtime_error("Failed to start phonemizer process: " + std::string(std::strerror(errno)));
+      }
+
+      if (pid == 0)
+      {
+        // Worker process; an orphaned worker exits on its next wait
+        auto parentAlive = [parentPid]() { return getppid() == parentPid; };
+        SharedRing requests(channel->request, requestData, ringBytes, parentAlive);
+        SharedRing responses(channel->response, responseData, ringBytes, parentAlive);
+        runWorker(dataPath, *channel, requests, responses);
+      }
+
+      worker->pid = pid;
+      Worker* workerPtr = worker.get();
+      auto workerAlive = [workerPtr]() { return workerPtr->isAlive(); };
+      worker->requests = std::make_unique<SharedRing>(channel->request, requestData, ringBytes, workerAlive);
+      worker->responses = std::make_unique<SharedRing>(channel->response, responseData, ringBytes, workerAlive);
+
+      m_workers.push_back(std::move(worker));
+    }
+
+    // Workers initialize eSpeak in parallel
+    for (auto& worker : m_workers)
+    {
+      if (readU32(*worker->responses) == RESPONSE_ERROR)
+      {
+        throw std::runtime_error(readString(*worker->responses));
+      }
+
+      m_idleWorkers.push_back(worker.get());
+    }
+  }
+  catch (...)
+  {
+    stopWorkers();
+    throw;
+  }
+
+  m_numHealthy = m_workers.size();
+  spdlog::debug("Started {} phonemizer process(es)", m_workers.size());
+}
+
+PhonemizerPool::~PhonemizerPool() { stopWorkers(); }
+
+void PhonemizerPool::stopWorkers() {
+  std::string quit;
+  putU32(quit, REQUEST_QUIT);
+
+  for (auto& worker : m_workers)
+  {
+    if (!worker->isAlive())
+    {
+      continue;
+    }
+
+    try
+    {
+      worker->requests->write(quit);
+    }
+    catch (const std::exception&)
+    {
+      // Already gone
+    }
+
+    for (int check = 0; (check < QUIT_CHECKS) && worker->isAlive(); check++)
+    {
+      std::this_thread::sleep_for(QUIT_CHECK_INTERVAL);
+    }
+
+    if (!worker->exited)
+    {
+      spdlog::warn("Phonemizer process {} did not quit, killing it", worker->pid);
+      worker->kill();
+    }
+  }
+
+  m_workers.clear();
+}
+
+PhonemizerPool::Worker& PhonemizerPool::acquireWorker(const std::string& voice) {
+  std::unique_lock<std::mutex> lock(m_idleMutex);
+  m_idleChanged.wait(lock, [this]() { return !m_idleWorkers.empty() || (m_numHealthy == 0); });
+
+  if (m_idleWorkers.empty())
+  {
+    throw std::runtime_error("No phonemizer processes left");
+  }
+
+  // Prefer a worker that already has the voice loaded
+  auto idleWorker = std::find_if(
+      m_idleWorkers.begin(), m_idleWorkers.end(), [&voice](const Worker* worker) { return worker->voice == voice; });
+  if (idleWorker == m_idleWorkers.end())
+  {
+    // Released workers go to the back, so the front one has been idle the longest
+    idleWorker = m_idleWorkers.begin();
+  }
+
+  Worker* worker = *idleWorker;
+  m_idleWorkers.erase(idleWorker);
+
+  m_voiceStats.selections++;
+  if (worker->voice != voice)
+  {
+    m_voiceStats.switches++;
+    worker->voice = voice;
+  }
+
+  return *worker;
+}
+
+void PhonemizerPool::releaseWorker(Worker& worker, bool healthy) {
+  if (!healthy)
+  {
+    // Its rings may be mid-message, so it can't be reused
+    spdlog::error("Phonemizer process {} failed", worker.pid);
+    worker.kill();
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(m_idleMutex);
+    if (healthy)
+    {
+      m_idleWorkers.push_back(&worker);
+    }
+    else
+    {
+      m_numHealthy--;
+    }
+  }
+
+  m_idleChanged.notify_all();
+}
+
+std::size_t PhonemizerPool::getNumWorkers() const {
+  std::lock_guard<std::mutex> lock(m_idleMutex);
+  return m_numHealthy;
+}
+
+VoiceSwitchStats PhonemizerPool::getVoiceSwitchStats() const {
+  std::lock_guard<std::mutex> lock(m_idleMutex);
+  return m_voiceStats;
+}
+
+void PhonemizerPool::phonemize(const std::string& text,
+                               eSpeakPhonemeConfig& config,
+                               const ClauseCallback& clauseCallback) {
+  phonemizeWithCache(text, config, clauseCallback, [this](const std::string& uncachedText,
+                                                          eSpeakPhonemeConfig& uncachedConfig,
+                                                          const ClauseSpanCallback& uncachedCallback) {
+    phonemizeUncached(uncachedText, uncachedConfig, uncachedCallback);
+  });
+}
+
+void PhonemizerPool::phonemizeUncached(const std::string& text,
+                                       eSpeakPhonemeConfig& config,
+                                       const ClauseSpanCallback& clauseCallback) {
+  Worker& worker = acquireWorker(config.voice);
+
+  std::exception_ptr error;
+  try
+  {
+    error = phonemizeOnWorker(worker, text, config, clauseCallback);
+  }
+  catch (...)
+  {
+    releaseWorker(worker, false);
+    throw;
+  }
+
+  if (error)
+  {
+    // The worker may not have loaded the voice
+    worker.voice.clear();
+  }
+
+  releaseWorker(worker, true);
+  if (error)
+  {
+    std::rethrow_exception(error);
+  }
+}
+
+std::exception_ptr PhonemizerPool::phonemizeOnWorker(Worker& worker,
+                                                     const std::string& text,
+                                                     eSpeakPhonemeConfig& config,
+                                                     const ClauseSpanCallback& clauseCallback) {
+  worker.channel->cancelled = 0;
+  worker.requests->write(encodeRequest(text, config));
+
+  std::exception_ptr error;
+  bool listening = true;
+  std::vector<Phoneme> sentencePhonemes;
+
+  // Always reads up to the end of the response, so the worker is ready for the next request
+  while (true)
+  {
+    uint32_t numPhonemes = readU32(*worker.responses);
+    if (numPhonemes == RESPONSE_END)
+    {
+      break;
+    }
+
+    if (numPhonemes == RESPONSE_ERROR)
+    {
+      std::string message = readString(*worker.responses);
+      if (!error)
+      {
+        error = std::make_exception_ptr(std::runtime_error(message));
+      }
+
+      break;
+    }
+
+    readPhonemes(*worker.responses, numPhonemes, sentencePhonemes);
+    uint32_t textBytes = readU32(*worker.responses);
+    if (!listening)
+    {
+      // Sent before the worker saw the cancellation
+      continue;
+    }
+
+    try
+    {
+      listening = clauseCallback(sentencePhonemes, textBytes);
+    }
+    catch (...)
+    {
+      error = std::current_exception();
+      listening = false;
+    }
+
+    if (!listening)
+    {
+      worker.channel->cancelled = 1;
+    }
+  }
+
+  return error;
+}
+
+#endif
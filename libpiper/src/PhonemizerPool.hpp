@@ -0,0 +1,75 @@
+#ifndef PHONEMIZER_POOL_H
+#define PHONEMIZER_POOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "phonemize.hpp"
+
+namespace piper {
+
+// Pool of forked worker processes, each with its own warm eSpeak instance.
+// eSpeak keeps global state, so one process phonemizes one text at a time;
+// with a pool, phonemization scales with the number of workers.
+//
+// Text and phonemes travel over a pair of shared-memory rings per worker.
+// Only available on POSIX systems.
+//
+// Create the pool before starting other threads: workers are forked,
+// and a forked child only gets a copy of the calling thread.
+class PhonemizerPool
+{
+public:
+  static const std::size_t DEFAULT_RING_BYTES = 1 << 20;
+
+  // numWorkers = 0 uses one worker per core.
+  // ringBytes is the size of each direction's ring; messages of any size still fit.
+  PhonemizerPool(const std::string& dataPath, std::size_t numWorkers, std::size_t ringBytes = DEFAULT_RING_BYTES);
+  ~PhonemizerPool();
+
+  PhonemizerPool(const PhonemizerPool&) = delete;
+  PhonemizerPool& operator=(const PhonemizerPool&) = delete;
+
+  // Same contract as phonemize_eSpeak, but the text is phonemized by an idle worker.
+  // Waits for one if all are busy. config.cache is used on the calling side.
+  void phonemize(const std::string& text, eSpeakPhonemeConfig& config, const ClauseCallback& clauseCallback);
+
+  // Workers still running
+  std::size_t getNumWorkers() const;
+
+  // Requests are sent to idle workers that last used the same voice where possible.
+  // A switch is a request that made a worker load a different voice.
+  VoiceSwitchStats getVoiceSwitchStats() const;
+
+private:
+  struct Worker;
+
+  void phonemizeUncached(const std::string& text, eSpeakPhonemeConfig& config, const ClauseSpanCallback& clauseCallback);
+
+  // Throws if the worker can't be reached; returns errors of eSpeak or the callback after the worker is idle again
+  std::exception_ptr phonemizeOnWorker(Worker& worker,
+                                       const std::string& text,
+                                       eSpeakPhonemeConfig& config,
+                                       const ClauseSpanCallback& clauseCallback);
+
+  Worker& acquireWorker(const std::string& voice);
+  void releaseWorker(Worker& worker, bool healthy);
+  void stopWorkers();
+
+  std::vector<std::unique_ptr<Worker>> m_workers;
+
+  mutable std::mutex m_idleMutex;
+  std::condition_variable m_idleChanged;
+  std::vector<Worker*> m_idleWorkers;
+  std::size_t m_numHealthy = 0;
+  VoiceSwitchStats m_voiceStats;
+};
+
+} // namespace piper
+
+#endif // PHONEMIZER_POOL_H
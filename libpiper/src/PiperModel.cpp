@@ -1,15 +1,29 @@
-#include <espeak-ng/speak_lib.h>
+#include <algorithm>
+#include <condition_variable>
 #include <fstream>
+#include <iomanip>
+#include <mutex>
 #include <spdlog/spdlog.h>
 #include <sstream>
+#include <thread>
 
+#include "BoundedQueue.hpp"
+#include "ESpeakService.hpp"
 #include "FileManager.hpp"
 #include "PiperModel.hpp"
+#include "hash.hpp"
 
 using namespace piper;
 
-PiperModel::PiperModel(const std::string& modelPath, const std::string& modelConfigPath)
-    : m_voice(modelPath, modelConfigPath) {
+PiperModel::PiperModel(const std::string& modelPath,
+                       const std::string& modelConfigPath,
+                       const PiperConfig& config)
+    : m_config(config), m_voice(modelPath, modelConfigPath, config.voiceOptions) {
+  if (config.phraseCacheBytes > 0)
+  {
+    m_phraseCache = std::make_unique<PhraseAudioCache>(config.phraseCacheBytes);
+  }
+
   eSpeakDataPath = std::filesystem::absolute(FileManager::getDataSharePath() / "espeak-ng-data").string();
 
   // Enable libtashkeel for Arabic
@@ -21,18 +35,12 @@ PiperModel::PiperModel(const std::string& modelPath, const std::string& modelCon
     spdlog::debug("libtashkeel model is expected at {}", tashkeelModelPath.value());
   }
 
-  // Set up espeak-ng for calling espeak_TextToPhonemesWithTerminator
-  // See: https://github.com/rhasspy/espeak-ng
-  spdlog::debug("Initializing eSpeak");
-  int result = espeak_Initialize(AUDIO_OUTPUT_SYNCHRONOUS, 0, eSpeakDataPath.c_str(), 0);
-  if (result < 0)
+  // eSpeak is shared with other models in this process, unless worker processes phonemize
+  if (!m_config.phonemizerPool)
   {
-    throw std::runtime_error("Failed to initialize eSpeak-ng"); // TODO: make error handling more
-                                                                // gracefull
+    m_eSpeak = ESpeakService::acquire(eSpeakDataPath);
   }
 
-  spdlog::debug("Initialized eSpeak");
-
   // Load onnx model for libtashkeel
   // https://github.com/mush42/libtashkeel/
   if (useTashkeel)
@@ -49,14 +57,17 @@ PiperModel::PiperModel(const std::string& modelPath, const std::string& modelCon
     spdlog::debug("Initialized libtashkeel");
   }
 
+  if ((config.voiceOptions.normalization == AudioNormalization::FixedGain) && (config.voiceOptions.outputGain <= 0))
+  {
+    calibrateOutputGain();
+  }
+
   spdlog::info("Initialized piper");
 }
 
 PiperModel::~PiperModel() {
-  // Clean up espeak-ng
-  spdlog::debug("Terminating eSpeak");
-  espeak_Terminate();
-  spdlog::debug("Terminated eSpeak");
+  // eSpeak is terminated when the last model releases it
+  m_eSpeak.reset();
 
   spdlog::info("Terminated piper");
 }
@@ -64,168 +75,776 @@ PiperModel::~PiperModel() {
 // Phonemize text and synthesize audio
 std::vector<int16_t> PiperModel::textToSpeech(std::string text) {
   std::vector<int16_t> audioBuffer;
-  std::size_t sentenceSilenceSamples = m_voice.getSentenceSilenceSamples();
 
-  if (useTashkeel)
+  textToSpeechSamples(std::move(text), [&audioBuffer](const int16_t* audio, std::size_t audioCount) {
+    audioBuffer.insert(audioBuffer.end(), audio, audio + audioCount);
+  });
+
+  return audioBuffer;
+}
+
+// Phonemize text and stream audio to the callback phrase by phrase
+void PiperModel::textToSpeech(std::string text, const AudioCallback& audioCallback) {
+  // Cached audio has to be copied out of the mapping for the vector interface
+  speak(std::move(text), audioCallback, [&audioCallback](const int16_t* audio, std::size_t audioCount) {
+    audioCallback(std::vector<int16_t>(audio, audio + audioCount));
+  });
+}
+
+void PiperModel::textToSpeechSamples(std::string text, const Int16AudioCallback& audioCallback) {
+  speak(
+      std::move(text),
+      [&audioCallback](const std::vector<int16_t>& audioChunk) { audioCallback(audioChunk.data(), audioChunk.size()); },
+      audioCallback);
+}
+
+void PiperModel::speak(std::string text, const AudioCallback& audioCallback, const Int16AudioCallback& cachedCallback) {
+  m_lastSynthesisResult = SynthesisResult{};
+
+  std::string audioCacheKey;
+  if (m_config.audioCache)
   {
-    if (!tashkeelState)
+    audioCacheKey = getAudioCacheKey(text);
+    if (auto cachedAudio = m_config.audioCache->find(audioCacheKey))
     {
-      throw std::runtime_error("Tashkeel model is not loaded");
+      spdlog::debug("Using cached audio for text: {}", text);
+
+      auto samples = static_cast<const int16_t*>(cachedAudio->data());
+      std::size_t sampleCount = cachedAudio->size() / sizeof(int16_t);
+      m_lastSynthesisResult.audioSeconds = (double) sampleCount / (double) m_voice.getSampleRate();
+
+      cachedCallback(samples, sampleCount);
+      return;
     }
+  }
 
-    spdlog::debug("Diacritizing text with libtashkeel: {}", text);
-    text = tashkeel::tashkeel_run(text, *tashkeelState);
+  // Keep a copy of the audio for the cache
+  std::vector<int16_t> uncachedAudio;
+  AudioCallback chunkCallback = audioCallback;
+  if (m_config.audioCache)
+  {
+    chunkCallback = [&uncachedAudio, &audioCallback](const std::vector<int16_t>& audioChunk) {
+      uncachedAudio.insert(uncachedAudio.end(), audioChunk.begin(), audioChunk.end());
+      audioCallback(audioChunk);
+    };
   }
 
-  // Phonemes for each sentence
+  diacritize(text);
+
   spdlog::debug("Phonemizing text: {}", text);
-  std::vector<std::vector<Phoneme>> phonemes;
 
   // Use espeak-ng for phonemization
   eSpeakPhonemeConfig eSpeakConfig;
   eSpeakConfig.voice = m_voice.getLanguage();
-  phonemize_eSpeak(text, eSpeakConfig, phonemes);
+  eSpeakConfig.cache = m_config.phonemeCache;
+
+  // Use phoneme/id map from config
+  PhonemeIdConfig idConfig;
+  idConfig.phonemeIdTable = m_voice.getPhonemeIdTable();
 
-  // Synthesize each sentence independently.
-  std::vector<PhonemeId> phonemeIds;
   std::map<Phoneme, std::size_t> missingPhonemes;
-  for (auto phonemesIter = phonemes.begin(); phonemesIter != phonemes.end(); ++phonemesIter)
+  if (m_config.numWorkers > 1)
+  {
+    synthesizeParallel(text, eSpeakConfig, idConfig, missingPhonemes, chunkCallback);
+  }
+  else
   {
-    std::vector<Phoneme>& sentencePhonemes = *phonemesIter;
+    std::vector<int16_t> audioChunk;
+    forEachPhrase(text, eSpeakConfig, idConfig, missingPhonemes, [&](Phrase& phrase) {
+      synthesizePhrase(phrase, audioChunk, chunkCallback);
+    });
+  }
 
-    if (spdlog::should_log(spdlog::level::debug))
+  logMissingPhonemes(missingPhonemes);
+
+  if (m_config.audioCache)
+  {
+    m_config.audioCache->store(audioCacheKey, uncachedAudio);
+  }
+
+  if (m_lastSynthesisResult.audioSeconds > 0)
+  {
+    m_lastSynthesisResult.realTimeFactor = m_lastSynthesisResult.inferSeconds / m_lastSynthesisResult.audioSeconds;
+  }
+}
+
+// Synthesize the constant segments of a template prompt
+PromptTemplate PiperModel::prepareTemplate(const std::string& templateText) {
+  PromptTemplate promptTemplate;
+  promptTemplate.segments = PromptTemplate::parse(templateText);
+  promptTemplate.crossfadeSamples = m_config.templateCrossfadeSeconds * m_voice.getSampleRate();
+
+  std::size_t numSegments = promptTemplate.segments.size();
+  for (std::size_t segmentIdx = 0; segmentIdx < numSegments; segmentIdx++)
+  {
+    PromptTemplate::Segment& segment = promptTemplate.segments[segmentIdx];
+    if (segment.isSlot)
     {
-      // DEBUG log for phonemes
-      std::string phonemesStr;
-      for (auto phoneme : sentencePhonemes)
-      {
-        utf8::append(phoneme, std::back_inserter(phonemesStr));
-      }
+      continue;
+    }
+
+    // Silence is only kept at the very start and end of the prompt
+    segment.audio = textToSpeech(segment.text);
+    trimSilence(segment.audio, segmentIdx > 0, segmentIdx + 1 < numSegments);
+  }
+
+  return promptTemplate;
+}
+
+// Synthesize the slots of a template prompt and stitch them between its constant segments
+std::vector<int16_t> PiperModel::textToSpeech(const PromptTemplate& promptTemplate,
+                                              const std::map<std::string, std::string>& slotValues) {
+  SynthesisResult promptResult{};
+  std::vector<int16_t> audioBuffer;
+
+  std::size_t numSegments = promptTemplate.segments.size();
+  for (std::size_t segmentIdx = 0; segmentIdx < numSegments; segmentIdx++)
+  {
+    const PromptTemplate::Segment& segment = promptTemplate.segments[segmentIdx];
+    if (!segment.isSlot)
+    {
+      appendWithCrossfade(audioBuffer, segment.audio, promptTemplate.crossfadeSamples);
+      continue;
+    }
 
-      spdlog::debug("Converting {} phoneme(s) to ids: {}", sentencePhonemes.size(), phonemesStr);
+    auto slotValue = slotValues.find(segment.text);
+    if (slotValue == slotValues.end())
+    {
+      throw std::runtime_error("No value for template slot: " + segment.text);
     }
 
-    std::vector<std::shared_ptr<std::vector<Phoneme>>> phrasePhonemes;
-    std::vector<SynthesisResult> phraseResults;
-    std::vector<size_t> phraseSilenceSamples;
+    std::vector<int16_t> slotAudio = textToSpeech(slotValue->second);
+    promptResult.inferSeconds += m_lastSynthesisResult.inferSeconds;
+
+    trimSilence(slotAudio, segmentIdx > 0, segmentIdx + 1 < numSegments);
+    appendWithCrossfade(audioBuffer, slotAudio, promptTemplate.crossfadeSamples);
+  }
+
+  promptResult.audioSeconds = (double) audioBuffer.size() / (double) m_voice.getSampleRate();
+  if (promptResult.audioSeconds > 0)
+  {
+    promptResult.realTimeFactor = promptResult.inferSeconds / promptResult.audioSeconds;
+  }
+
+  m_lastSynthesisResult = promptResult;
+  return audioBuffer;
+}
+
+// Phonemize text and stream float audio to the callback phrase by phrase
+void PiperModel::textToSpeechFloat(std::string text, const FloatAudioCallback& audioCallback) {
+  m_lastSynthesisResult = SynthesisResult{};
+  diacritize(text);
+
+  spdlog::debug("Phonemizing text: {}", text);
+
+  eSpeakPhonemeConfig eSpeakConfig;
+  eSpeakConfig.voice = m_voice.getLanguage();
+  eSpeakConfig.cache = m_config.phonemeCache;
 
-    // Use phoneme/id map from config
-    PhonemeIdConfig idConfig;
-    idConfig.phonemeIdMap = std::make_shared<PhonemeIdMap>(m_voice.getPhonemeIdMap());
+  PhonemeIdConfig idConfig;
+  idConfig.phonemeIdTable = m_voice.getPhonemeIdTable();
 
-    if (m_voice.getPhonemeSilenceSeconds())
+  std::map<Phoneme, std::size_t> missingPhonemes;
+  std::vector<float> silence;
+  forEachPhrase(text, eSpeakConfig, idConfig, missingPhonemes, [&](Phrase& phrase) {
+    if (!phrase.phonemeIds.empty())
     {
-      // Split into phrases
-      std::map<Phoneme, float> phonemeSilenceSeconds = m_voice.getPhonemeSilenceSeconds().value();
+      // Samples go straight from the output tensor to the callback
+      SynthesisResult phraseResult;
+      m_voice.synthesize(phrase.phonemeIds, phraseResult, audioCallback);
 
-      auto currentPhrasePhonemes = std::make_shared<std::vector<Phoneme>>();
-      phrasePhonemes.push_back(currentPhrasePhonemes);
+      m_lastSynthesisResult.audioSeconds += phraseResult.audioSeconds;
+      m_lastSynthesisResult.inferSeconds += phraseResult.inferSeconds;
+    }
 
-      for (auto sentencePhonemesIter = sentencePhonemes.begin(); sentencePhonemesIter != sentencePhonemes.end();
-           sentencePhonemesIter++)
+    if (phrase.silenceSamples > 0)
+    {
+      if (silence.size() < phrase.silenceSamples)
       {
-        Phoneme& currentPhoneme = *sentencePhonemesIter;
-        currentPhrasePhonemes->push_back(currentPhoneme);
+        silence.resize(phrase.silenceSamples, 0.0f);
+      }
 
-        if (phonemeSilenceSeconds.count(currentPhoneme) > 0)
-        {
-          // Split at phrase boundary
-          phraseSilenceSamples.push_back(
-              (std::size_t)(phonemeSilenceSeconds[currentPhoneme] * m_voice.getSampleRate() * m_voice.getChannels()));
+      audioCallback(silence.data(), phrase.silenceSamples);
+    }
+  });
 
-          currentPhrasePhonemes = std::make_shared<std::vector<Phoneme>>();
-          phrasePhonemes.push_back(currentPhrasePhonemes);
-        }
+  logMissingPhonemes(missingPhonemes);
+
+  if (m_lastSynthesisResult.audioSeconds > 0)
+  {
+    m_lastSynthesisResult.realTimeFactor = m_lastSynthesisResult.inferSeconds / m_lastSynthesisResult.audioSeconds;
+  }
+}
+
+// Phonemize texts and synthesize their phrases in batches
+std::vector<std::vector<int16_t>> PiperModel::textToSpeechBatch(const std::vector<std::string>& texts,
+                                                                std::size_t maxBatchSize) {
+  m_lastSynthesisResult = SynthesisResult{};
+
+  eSpeakPhonemeConfig eSpeakConfig;
+  eSpeakConfig.voice = m_voice.getLanguage();
+  eSpeakConfig.cache = m_config.phonemeCache;
+
+  PhonemeIdConfig idConfig;
+  idConfig.phonemeIdTable = m_voice.getPhonemeIdTable();
+
+  // Collect phrases of all texts; only phrases with ids need inference
+  std::vector<std::vector<Phrase>> textPhrases(texts.size());
+  std::vector<std::vector<PhonemeId>> batchIds;
+  std::map<Phoneme, std::size_t> missingPhonemes;
+  for (std::size_t textIdx = 0; textIdx < texts.size(); textIdx++)
+  {
+    std::string text = texts[textIdx];
+    diacritize(text);
+
+    spdlog::debug("Phonemizing text: {}", text);
+    phonemize(text, eSpeakConfig, [&](std::vector<Phoneme>& sentencePhonemes) {
+      preparePhrases(sentencePhonemes, idConfig, missingPhonemes, [&](Phrase& phrase) {
+        textPhrases[textIdx].push_back(std::move(phrase));
+        return true;
+      });
+      return true;
+    });
+  }
+
+  for (auto& phrases : textPhrases)
+  {
+    for (auto& phrase : phrases)
+    {
+      if (!phrase.phonemeIds.empty())
+      {
+        batchIds.push_back(phrase.phonemeIds);
       }
     }
-    else
+  }
+
+  logMissingPhonemes(missingPhonemes);
+
+  // ids -> audio
+  std::vector<std::vector<int16_t>> batchAudio;
+  std::vector<SynthesisResult> batchResults;
+  m_voice.synthesizeBatch(batchAudio, batchIds, batchResults, maxBatchSize);
+
+  for (auto& phraseResult : batchResults)
+  {
+    m_lastSynthesisResult.audioSeconds += phraseResult.audioSeconds;
+    m_lastSynthesisResult.inferSeconds += phraseResult.inferSeconds;
+  }
+
+  if (m_lastSynthesisResult.audioSeconds > 0)
+  {
+    m_lastSynthesisResult.realTimeFactor = m_lastSynthesisResult.inferSeconds / m_lastSynthesisResult.audioSeconds;
+  }
+
+  // Put phrase audio and silence back together per text
+  std::vector<std::vector<int16_t>> audioBuffers(texts.size());
+  std::size_t batchIdx = 0;
+  for (std::size_t textIdx = 0; textIdx < texts.size(); textIdx++)
+  {
+    std::vector<int16_t>& audioBuffer = audioBuffers[textIdx];
+    for (auto& phrase : textPhrases[textIdx])
     {
-      // Use all phonemes
-      phrasePhonemes.push_back(std::make_shared<std::vector<Phoneme>>(sentencePhonemes));
+      // Same order as the batch was built in
+      if (!phrase.phonemeIds.empty())
+      {
+        audioBuffer.insert(audioBuffer.end(), batchAudio[batchIdx].begin(), batchAudio[batchIdx].end());
+        batchIdx++;
+      }
+
+      audioBuffer.insert(audioBuffer.end(), phrase.silenceSamples, 0);
     }
+  }
+
+  return audioBuffers;
+}
 
-    // Ensure results/samples are the same size
-    while (phraseResults.size() < phrasePhonemes.size())
+void PiperModel::logMissingPhonemes(const std::map<Phoneme, std::size_t>& missingPhonemes) {
+  if (missingPhonemes.size() > 0)
+  {
+    spdlog::warn("Missing {} phoneme(s) from phoneme/id map!", missingPhonemes.size());
+
+    for (auto phonemeCount : missingPhonemes)
     {
-      phraseResults.emplace_back();
+      std::string phonemeStr;
+      utf8::append(phonemeCount.first, std::back_inserter(phonemeStr));
+      spdlog::warn(
+          "Missing \"{}\" (\\u{:04X}): {} time(s)", phonemeStr, (uint32_t) phonemeCount.first, phonemeCount.second);
     }
+  }
+}
+
+// Everything that changes the audio of a text
+std::string PiperModel::getAudioCacheKey(const std::string& text) {
+  SynthesisConfig& synthesisConfig = m_voice.getSynthesisConfig();
+  const VoiceOptions& voiceOptions = m_config.voiceOptions;
 
-    while (phraseSilenceSamples.size() < phrasePhonemes.size())
+  std::stringstream key;
+  key << std::setprecision(9) << hashToHex(m_voice.getModelHash()) << ' ' << hashToHex(m_voice.getConfigHash()) << '\n'
+      << synthesisConfig.noiseScale << ' ' << synthesisConfig.lengthScale << ' ' << synthesisConfig.noiseW << ' '
+      << synthesisConfig.sampleRate << ' ' << synthesisConfig.sentenceSilenceSeconds;
+
+  if (synthesisConfig.phonemeSilenceSeconds)
+  {
+    for (auto const& phonemeSilence : *synthesisConfig.phonemeSilenceSeconds)
     {
-      phraseSilenceSamples.push_back(0);
+      key << ' ' << (uint32_t) phonemeSilence.first << '=' << phonemeSilence.second;
     }
+  }
+
+  key << '\n' << (int) voiceOptions.normalization;
+  if (voiceOptions.normalization == AudioNormalization::FixedGain)
+  {
+    key << ' ' << m_voice.getOutputGain() << ' ' << voiceOptions.limiter.threshold << ' '
+        << voiceOptions.limiter.lookaheadSeconds << ' ' << voiceOptions.limiter.releaseSeconds;
+  }
 
-    // phonemes -> ids -> audio
-    for (size_t phraseIdx = 0; phraseIdx < phrasePhonemes.size(); phraseIdx++)
+  key << '\n' << text;
+  return key.str();
+}
+
+// Add diacritics to Arabic text
+void PiperModel::diacritize(std::string& text) {
+  if (useTashkeel)
+  {
+    if (!tashkeelState)
     {
-      if (phrasePhonemes[phraseIdx]->size() <= 0)
+      throw std::runtime_error("Tashkeel model is not loaded");
+    }
+
+    spdlog::debug("Diacritizing text with libtashkeel: {}", text);
+    text = tashkeel::tashkeel_run(text, *tashkeelState);
+  }
+}
+
+void PiperModel::phonemize(const std::string& text,
+                           eSpeakPhonemeConfig& eSpeakConfig,
+                           const ClauseCallback& clauseCallback) {
+  if (m_config.phonemizerPool)
+  {
+    m_config.phonemizerPool->phonemize(text, eSpeakConfig, clauseCallback);
+  }
+  else
+  {
+    m_eSpeak->phonemize(text, eSpeakConfig, clauseCallback);
+  }
+}
+
+// Synthesize the calibration text once to find a fixed output gain for the voice
+void PiperModel::calibrateOutputGain() {
+  std::string text = m_config.gainCalibrationText;
+  diacritize(text);
+
+  eSpeakPhonemeConfig eSpeakConfig;
+  eSpeakConfig.voice = m_voice.getLanguage();
+  eSpeakConfig.cache = m_config.phonemeCache;
+
+  PhonemeIdConfig idConfig;
+  idConfig.phonemeIdTable = m_voice.getPhonemeIdTable();
+
+  std::vector<std::vector<PhonemeId>> referencePhonemeIds;
+  std::map<Phoneme, std::size_t> missingPhonemes;
+  phonemize(text, eSpeakConfig, [&](std::vector<Phoneme>& sentencePhonemes) {
+    preparePhrases(sentencePhonemes, idConfig, missingPhonemes, [&](Phrase& phrase) {
+      if (!phrase.phonemeIds.empty())
       {
-        continue;
+        referencePhonemeIds.push_back(std::move(phrase.phonemeIds));
       }
+      return true;
+    });
+    return true;
+  });
+
+  m_voice.calibrateOutputGain(referencePhonemeIds);
+}
 
-      // phonemes -> ids
-      phonemes_to_ids(*(phrasePhonemes[phraseIdx]), idConfig, phonemeIds, missingPhonemes);
-      if (spdlog::should_log(spdlog::level::debug))
+// Split sentence into phrases and convert them to phoneme ids.
+// The callback may return false to stop early.
+void PiperModel::preparePhrases(std::vector<Phoneme>& sentencePhonemes,
+                                PhonemeIdConfig& idConfig,
+                                std::map<Phoneme, std::size_t>& missingPhonemes,
+                                const std::function<bool(Phrase&)>& phraseCallback) {
+  if (spdlog::should_log(spdlog::level::debug))
+  {
+    // DEBUG log for phonemes
+    std::string phonemesStr;
+    for (auto phoneme : sentencePhonemes)
+    {
+      utf8::append(phoneme, std::back_inserter(phonemesStr));
+    }
+
+    spdlog::debug("Converting {} phoneme(s) to ids: {}", sentencePhonemes.size(), phonemesStr);
+  }
+
+  std::vector<std::shared_ptr<std::vector<Phoneme>>> phrasePhonemes;
+  std::vector<size_t> phraseSilenceSamples;
+
+  if (m_voice.getPhonemeSilenceSeconds())
+  {
+    // Split into phrases
+    std::map<Phoneme, float> phonemeSilenceSeconds = m_voice.getPhonemeSilenceSeconds().value();
+
+    auto currentPhrasePhonemes = std::make_shared<std::vector<Phoneme>>();
+    phrasePhonemes.push_back(currentPhrasePhonemes);
+
+    for (auto sentencePhonemesIter = sentencePhonemes.begin(); sentencePhonemesIter != sentencePhonemes.end();
+         sentencePhonemesIter++)
+    {
+      Phoneme& currentPhoneme = *sentencePhonemesIter;
+      currentPhrasePhonemes->push_back(currentPhoneme);
+
+      if (phonemeSilenceSeconds.count(currentPhoneme) > 0)
       {
-        // DEBUG log for phoneme ids
-        std::stringstream phonemeIdsStr;
-        for (auto phonemeId : phonemeIds)
-        {
-          phonemeIdsStr << phonemeId << ", ";
-        }
+        // Split at phrase boundary
+        phraseSilenceSamples.push_back(
+            (std::size_t)(phonemeSilenceSeconds[currentPhoneme] * m_voice.getSampleRate() * m_voice.getChannels()));
 
-        spdlog::debug("Converted {} phoneme(s) to {} phoneme id(s): {}",
-                      phrasePhonemes[phraseIdx]->size(),
-                      phonemeIds.size(),
-                      phonemeIdsStr.str());
+        currentPhrasePhonemes = std::make_shared<std::vector<Phoneme>>();
+        phrasePhonemes.push_back(currentPhrasePhonemes);
       }
+    }
+  }
+  else
+  {
+    // Use all phonemes
+    phrasePhonemes.push_back(std::make_shared<std::vector<Phoneme>>(sentencePhonemes));
+  }
 
-      // ids -> audio
-      m_voice.synthesize(audioBuffer, phonemeIds, phraseResults[phraseIdx]);
+  // Ensure samples are the same size
+  while (phraseSilenceSamples.size() < phrasePhonemes.size())
+  {
+    phraseSilenceSamples.push_back(0);
+  }
 
-      // Add end of phrase silence
-      for (std::size_t i = 0; i < phraseSilenceSamples[phraseIdx]; i++)
+  // phonemes -> ids
+  for (size_t phraseIdx = 0; phraseIdx < phrasePhonemes.size(); phraseIdx++)
+  {
+    if (phrasePhonemes[phraseIdx]->size() <= 0)
+    {
+      continue;
+    }
+
+    Phrase phrase;
+    phrase.silenceSamples = phraseSilenceSamples[phraseIdx];
+    phonemes_to_ids(*(phrasePhonemes[phraseIdx]), idConfig, phrase.phonemeIds, missingPhonemes);
+    if (spdlog::should_log(spdlog::level::debug))
+    {
+      // DEBUG log for phoneme ids
+      std::stringstream phonemeIdsStr;
+      for (auto phonemeId : phrase.phonemeIds)
       {
-        audioBuffer.push_back(0);
+        phonemeIdsStr << phonemeId << ", ";
       }
 
-      m_lastSynthesisResult.audioSeconds += phraseResults[phraseIdx].audioSeconds;
-      m_lastSynthesisResult.inferSeconds += phraseResults[phraseIdx].inferSeconds;
+      spdlog::debug("Converted {} phoneme(s) to {} phoneme id(s): {}",
+                    phrasePhonemes[phraseIdx]->size(),
+                    phrase.phonemeIds.size(),
+                    phonemeIdsStr.str());
+    }
 
-      phonemeIds.clear();
+    if (!phraseCallback(phrase))
+    {
+      return;
     }
+  }
+
+  // Add end of sentence silence
+  std::size_t sentenceSilenceSamples = m_voice.getSentenceSilenceSamples();
+  if (sentenceSilenceSamples > 0)
+  {
+    Phrase silence;
+    silence.silenceSamples = sentenceSilenceSamples;
+    phraseCallback(silence);
+  }
+}
+
+// Phoneme ids -> audio, handed to the callback together with the trailing silence
+void PiperModel::synthesizePhrase(Phrase& phrase,
+                                  std::vector<int16_t>& audioChunk,
+                                  const AudioCallback& audioCallback) {
+  if (!phrase.phonemeIds.empty())
+  {
+    SynthesisResult phraseResult;
+    synthesizeIds(audioChunk, phrase.phonemeIds, phraseResult);
 
-    // Add end of sentence silence
-    if (sentenceSilenceSamples > 0)
+    m_lastSynthesisResult.audioSeconds += phraseResult.audioSeconds;
+    m_lastSynthesisResult.inferSeconds += phraseResult.inferSeconds;
+  }
+
+  audioChunk.insert(audioChunk.end(), phrase.silenceSamples, 0);
+
+  // Hand off phrase audio right away
+  audioCallback(audioChunk);
+  audioChunk.clear();
+}
+
+// Append audio for phoneme ids, reusing audio of identical phrases if the phrase cache is enabled
+void PiperModel::synthesizeIds(std::vector<int16_t>& audioBuffer,
+                               std::vector<PhonemeId>& phonemeIds,
+                               SynthesisResult& result) {
+  if (!m_phraseCache)
+  {
+    m_voice.synthesize(audioBuffer, phonemeIds, result);
+    return;
+  }
+
+  // Phrase audio only depends on the ids and the scales (the voice is fixed)
+  SynthesisConfig& synthesisConfig = m_voice.getSynthesisConfig();
+  const float scales[] = {synthesisConfig.noiseScale, synthesisConfig.lengthScale, synthesisConfig.noiseW};
+
+  std::string key(reinterpret_cast<const char*>(phonemeIds.data()), phonemeIds.size() * sizeof(PhonemeId));
+  key.append(reinterpret_cast<const char*>(scales), sizeof(scales));
+
+  if (auto cachedAudio = m_phraseCache->get(key))
+  {
+    audioBuffer.insert(audioBuffer.end(), cachedAudio->begin(), cachedAudio->end());
+
+    result = SynthesisResult{};
+    result.audioSeconds = (double) cachedAudio->size() / (double) synthesisConfig.sampleRate;
+    return;
+  }
+
+  std::size_t offset = audioBuffer.size();
+  m_voice.synthesize(audioBuffer, phonemeIds, result);
+
+  auto phraseAudio = std::make_shared<std::vector<int16_t>>(audioBuffer.begin() + offset, audioBuffer.end());
+  std::size_t bytes = PHRASE_CACHE_ENTRY_OVERHEAD + key.size() + (phraseAudio->size() * sizeof(int16_t));
+  m_phraseCache->put(key, std::move(phraseAudio), bytes);
+}
+
+// Phonemize text and hand each prepared phrase to the callback on the calling thread.
+// In pipelined mode, phonemization and id conversion run ahead on a producer thread.
+void PiperModel::forEachPhrase(const std::string& text,
+                               eSpeakPhonemeConfig& eSpeakConfig,
+                               PhonemeIdConfig& idConfig,
+                               std::map<Phoneme, std::size_t>& missingPhonemes,
+                               const std::function<void(Phrase&)>& phraseCallback) {
+  if (!m_config.pipelined)
+  {
+    // Synthesize each sentence as soon as it has been phonemized
+    phonemize(text, eSpeakConfig, [&](std::vector<Phoneme>& sentencePhonemes) {
+      preparePhrases(sentencePhonemes, idConfig, missingPhonemes, [&](Phrase& phrase) {
+        phraseCallback(phrase);
+        return true;
+      });
+      return true;
+    });
+
+    return;
+  }
+
+  BoundedQueue<Phrase> phraseQueue(m_config.pipelineQueueSize);
+  std::exception_ptr producerError;
+
+  std::thread producer([&]() {
+    try
+    {
+      phonemize(text, eSpeakConfig, [&](std::vector<Phoneme>& sentencePhonemes) {
+        bool keepGoing = true;
+        preparePhrases(sentencePhonemes, idConfig, missingPhonemes, [&](Phrase& phrase) {
+          keepGoing = phraseQueue.push(std::move(phrase));
+          return keepGoing;
+        });
+
+        return keepGoing;
+      });
+    }
+    catch (...)
+    {
+      producerError = std::current_exception();
+    }
+
+    phraseQueue.close();
+  });
+
+  std::exception_ptr consumerError;
+  try
+  {
+    Phrase phrase;
+    while (phraseQueue.pop(phrase))
+    {
+      phraseCallback(phrase);
+    }
+  }
+  catch (...)
+  {
+    // Stop the producer before rethrowing
+    consumerError = std::current_exception();
+    phraseQueue.close();
+  }
+
+  producer.join();
+
+  if (consumerError)
+  {
+    std::rethrow_exception(consumerError);
+  }
+
+  if (producerError)
+  {
+    std::rethrow_exception(producerError);
+  }
+}
+
+// Phonemize on a producer thread, synthesize phrases on a pool of workers
+// and hand the audio to the callback in the original phrase order
+void PiperModel::synthesizeParallel(const std::string& text,
+                                    eSpeakPhonemeConfig& eSpeakConfig,
+                                    PhonemeIdConfig& idConfig,
+                                    std::map<Phoneme, std::size_t>& missingPhonemes,
+                                    const AudioCallback& audioCallback) {
+  BoundedQueue<std::pair<std::size_t, Phrase>> phraseQueue(m_config.pipelineQueueSize);
+
+  // Guards everything below
+  std::mutex resultMutex;
+  std::condition_variable resultReady;
+  std::map<std::size_t, std::vector<int16_t>> finishedAudio;
+  std::size_t nextPhraseIdx = 0;
+  std::size_t numPhrases = 0;
+  bool producerDone = false;
+  std::exception_ptr error;
+
+  // Workers don't start phrases further ahead of delivery than this, so finished audio stays bounded
+  std::size_t maxPhrasesAhead = std::max(m_config.pipelineQueueSize, m_config.numWorkers);
+
+  auto setError = [&](std::exception_ptr currentError) {
     {
-      for (std::size_t i = 0; i < sentenceSilenceSamples; i++)
+      std::lock_guard<std::mutex> lock(resultMutex);
+      if (!error)
       {
-        audioBuffer.push_back(0);
+        error = currentError;
       }
     }
 
-    phonemeIds.clear();
-  }
+    resultReady.notify_all();
+    phraseQueue.close();
+  };
 
-  if (missingPhonemes.size() > 0)
+  std::thread producer([&]() {
+    std::size_t phraseIdx = 0;
+    try
+    {
+      phonemize(text, eSpeakConfig, [&](std::vector<Phoneme>& sentencePhonemes) {
+        bool keepGoing = true;
+        preparePhrases(sentencePhonemes, idConfig, missingPhonemes, [&](Phrase& phrase) {
+          keepGoing = phraseQueue.push(std::make_pair(phraseIdx, std::move(phrase)));
+          phraseIdx++;
+          return keepGoing;
+        });
+
+        return keepGoing;
+      });
+    }
+    catch (...)
+    {
+      setError(std::current_exception());
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(resultMutex);
+      numPhrases = phraseIdx;
+      producerDone = true;
+    }
+
+    resultReady.notify_all();
+
+    // Workers drain what is left
+    phraseQueue.close();
+  });
+
+  std::vector<std::thread> workers;
+  for (std::size_t workerIdx = 0; workerIdx < m_config.numWorkers; workerIdx++)
   {
-    spdlog::warn("Missing {} phoneme(s) from phoneme/id map!", missingPhonemes.size());
+    workers.emplace_back([&]() {
+      std::pair<std::size_t, Phrase> job;
+      while (phraseQueue.pop(job))
+      {
+        {
+          std::unique_lock<std::mutex> lock(resultMutex);
+          resultReady.wait(lock, [&]() { return error || (job.first < nextPhraseIdx + maxPhrasesAhead); });
+          if (error)
+          {
+            break;
+          }
+        }
 
-    for (auto phonemeCount : missingPhonemes)
+        try
+        {
+          Phrase& phrase = job.second;
+          std::vector<int16_t> phraseAudio;
+          SynthesisResult phraseResult{};
+          if (!phrase.phonemeIds.empty())
+          {
+            synthesizeIds(phraseAudio, phrase.phonemeIds, phraseResult);
+          }
+
+          phraseAudio.insert(phraseAudio.end(), phrase.silenceSamples, 0);
+
+          {
+            std::lock_guard<std::mutex> lock(resultMutex);
+            finishedAudio[job.first] = std::move(phraseAudio);
+            m_lastSynthesisResult.audioSeconds += phraseResult.audioSeconds;
+            m_lastSynthesisResult.inferSeconds += phraseResult.inferSeconds;
+          }
+
+          resultReady.notify_all();
+        }
+        catch (...)
+        {
+          setError(std::current_exception());
+          break;
+        }
+      }
+    });
+  }
+
+  // Splice results back together in order on the calling thread
+  try
+  {
+    std::vector<int16_t> audioChunk;
+    while (true)
     {
-      std::string phonemeStr;
-      utf8::append(phonemeCount.first, std::back_inserter(phonemeStr));
-      spdlog::warn(
-          "Missing \"{}\" (\\u{:04X}): {} time(s)", phonemeStr, (uint32_t) phonemeCount.first, phonemeCount.second);
+      {
+        std::unique_lock<std::mutex> lock(resultMutex);
+        resultReady.wait(lock, [&]() {
+          return error || (finishedAudio.count(nextPhraseIdx) > 0) || (producerDone && (nextPhraseIdx >= numPhrases));
+        });
+
+        auto finishedIter = finishedAudio.find(nextPhraseIdx);
+        if (error || (finishedIter == finishedAudio.end()))
+        {
+          break;
+        }
+
+        audioChunk = std::move(finishedIter->second);
+        finishedAudio.erase(finishedIter);
+      }
+
+      audioCallback(audioChunk);
+
+      {
+        std::lock_guard<std::mutex> lock(resultMutex);
+        nextPhraseIdx++;
+      }
+
+      // Wakes up workers waiting to run ahead
+      resultReady.notify_all();
     }
   }
+  catch (...)
+  {
+    setError(std::current_exception());
+  }
 
-  if (m_lastSynthesisResult.audioSeconds > 0)
+  producer.join();
+  for (auto& worker : workers)
   {
-    m_lastSynthesisResult.realTimeFactor = m_lastSynthesisResult.inferSeconds / m_lastSynthesisResult.audioSeconds;
+    worker.join();
   }
 
-  return audioBuffer;
+  if (error)
+  {
+    std::rethrow_exception(error);
+  }
 }
 
 // Phonemize text and synthesize audio to WAV file
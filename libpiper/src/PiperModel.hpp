@@ -7,28 +7,163 @@
 #include <string>
 #include <vector>
 
+#include "AudioCache.hpp"
+#include "ESpeakService.hpp"
+#include "LruCache.hpp"
+#include "PhonemizerPool.hpp"
+#include "PromptTemplate.hpp"
 #include "Voice.hpp"
 #include "tashkeel.hpp"
 #include "wavfile.hpp"
 
 namespace piper {
 
+// Receives each chunk of synthesized audio as soon as it is available
+typedef std::function<void(const std::vector<int16_t>& audioChunk)> AudioCallback;
+
+// Same, but the samples are passed in place, e.g. straight from the memory mapping of the audio cache
+typedef std::function<void(const int16_t* audio, std::size_t audioCount)> Int16AudioCallback;
+
+// Audio of single phrases, keyed by their phoneme ids and scales
+typedef LruCache<std::string, std::vector<int16_t>> PhraseAudioCache;
+
+struct PiperConfig
+{
+  // Phonemize on a background thread while inference runs on the calling thread
+  bool pipelined = false;
+
+  // Maximum number of prepared phrases waiting for inference in pipelined mode.
+  // With numWorkers > 1, also how far workers may run ahead of the phrase being delivered (at least numWorkers).
+  std::size_t pipelineQueueSize = 8;
+
+  // Number of threads synthesizing phrases in parallel.
+  // More than one always phonemizes on a background thread; audio is still delivered in order.
+  std::size_t numWorkers = 1;
+
+  // Cache of phonemized clauses, e.g. std::make_shared<PhonemeCache>(4 << 20) for 4 MiB.
+  // The same cache can be shared by several PiperModel instances.
+  std::shared_ptr<PhonemeCache> phonemeCache;
+
+  // Phonemize in forked worker processes instead of the shared in-process eSpeak, e.g. with many numWorkers.
+  // The pool must be created before any other threads are started.
+  std::shared_ptr<PhonemizerPool> phonemizerPool;
+
+  // Overlap between the precomputed and the synthesized segments of a template prompt
+  float templateCrossfadeSeconds = 0.01f;
+
+  // Memory budget for reusing the audio of repeated phrases in textToSpeech (0 = disabled)
+  std::size_t phraseCacheBytes = 0;
+
+  // Synthesized audio stored on disk and reused for repeated texts by textToSpeech.
+  // The cache directory can be shared by several processes.
+  std::shared_ptr<AudioCache> audioCache;
+
+  // Onnx session settings, e.g. the session profile or the number of session replicas shared by the workers
+  VoiceOptions voiceOptions;
+
+  // Reference text for calibrating the output gain of FixedGain normalization
+  std::string gainCalibrationText = "The quick brown fox jumps over the lazy dog. "
+                                    "How loud should a typical sentence be?";
+};
+
 class PiperModel
 {
 public:
-  PiperModel(const std::string& modelPath, const std::string& modelConfigPath = "");
+  PiperModel(const std::string& modelPath,
+             const std::string& modelConfigPath = "",
+             const PiperConfig& config = PiperConfig());
   ~PiperModel();
 
   std::vector<int16_t> textToSpeech(std::string text);
+
+  // Streams audio phrase by phrase instead of returning it all at once.
+  // Each chunk holds one phrase followed by its silence; end of sentence silence is a separate chunk.
+  // Texts found in the audio cache arrive as a single chunk.
+  void textToSpeech(std::string text, const AudioCallback& audioCallback);
+
+  // Same as above, but texts found in the audio cache are passed without copying them out of the cache file
+  void textToSpeechSamples(std::string text, const Int16AudioCallback& audioCallback);
+
+  // Streams normalized float audio without an intermediate int16 copy.
+  // Phrase audio and silence are passed in separate calls.
+  // Unlike textToSpeech, this always synthesizes: the audio cache and the phrase cache are neither read
+  // nor filled, and phrases are synthesized one at a time, even when numWorkers > 1.
+  // The phoneme cache is still used.
+  void textToSpeechFloat(std::string text, const FloatAudioCallback& audioCallback);
+
+  // Synthesizes many (short) texts at once using batched inference.
+  // Returns one audio buffer per text.
+  // Batching needs a model that outputs the audio length of each row (see Voice::synthesizeBatch);
+  // Piper's own exports don't, so their phrases are synthesized one at a time.
+  std::vector<std::vector<int16_t>> textToSpeechBatch(const std::vector<std::string>& texts,
+                                                      std::size_t maxBatchSize = 8);
+
+  // Synthesizes the constant segments of a template like "The temperature in {city} is {n} degrees" once.
+  // The template is tied to this model's voice and current synthesis settings.
+  PromptTemplate prepareTemplate(const std::string& templateText);
+
+  // Synthesizes only the slot values and stitches them between the precomputed segments.
+  // Throws if a slot has no value.
+  std::vector<int16_t> textToSpeech(const PromptTemplate& promptTemplate,
+                                    const std::map<std::string, std::string>& slotValues);
+
   void saveToWavFile(const std::string& fileName, std::vector<int16_t> audioBuffer);
 
+  // Timing of the last call to textToSpeech
+  const SynthesisResult& getLastSynthesisResult() const { return m_lastSynthesisResult; }
+
+  // Hits, misses and evictions of the phrase cache (all zero when it is disabled)
+  CacheStats getPhraseCacheStats() { return m_phraseCache ? m_phraseCache->getStats() : CacheStats(); }
+
+  // Inference settings of the voice, e.g. noise and length scales
+  SynthesisConfig& getSynthesisConfig() { return m_voice.getSynthesisConfig(); }
+
 private:
+  // Phoneme ids for one phrase and the silence that follows it.
+  // Phrases without ids only carry silence (e.g. at the end of a sentence).
+  struct Phrase
+  {
+    std::vector<PhonemeId> phonemeIds;
+    std::size_t silenceSamples = 0;
+  };
+
+  // Synthesized audio goes to audioCallback, audio found in the audio cache to cachedCallback
+  void speak(std::string text, const AudioCallback& audioCallback, const Int16AudioCallback& cachedCallback);
+  void diacritize(std::string& text);
+  void phonemize(const std::string& text, eSpeakPhonemeConfig& eSpeakConfig, const ClauseCallback& clauseCallback);
+  std::string getAudioCacheKey(const std::string& text);
+  void calibrateOutputGain();
+  void logMissingPhonemes(const std::map<Phoneme, std::size_t>& missingPhonemes);
+  void preparePhrases(std::vector<Phoneme>& sentencePhonemes,
+                      PhonemeIdConfig& idConfig,
+                      std::map<Phoneme, std::size_t>& missingPhonemes,
+                      const std::function<bool(Phrase&)>& phraseCallback);
+  void synthesizePhrase(Phrase& phrase, std::vector<int16_t>& audioChunk, const AudioCallback& audioCallback);
+  void synthesizeIds(std::vector<int16_t>& audioBuffer, std::vector<PhonemeId>& phonemeIds, SynthesisResult& result);
+  void forEachPhrase(const std::string& text,
+                     eSpeakPhonemeConfig& eSpeakConfig,
+                     PhonemeIdConfig& idConfig,
+                     std::map<Phoneme, std::size_t>& missingPhonemes,
+                     const std::function<void(Phrase&)>& phraseCallback);
+  void synthesizeParallel(const std::string& text,
+                          eSpeakPhonemeConfig& eSpeakConfig,
+                          PhonemeIdConfig& idConfig,
+                          std::map<Phoneme, std::size_t>& missingPhonemes,
+                          const AudioCallback& audioCallback);
+
+  PiperConfig m_config;
   std::string eSpeakDataPath;
+  std::shared_ptr<ESpeakService> m_eSpeak;
   bool useTashkeel = false;
   std::optional<std::string> tashkeelModelPath;
   std::unique_ptr<tashkeel::State> tashkeelState;
   Voice m_voice;
   SynthesisResult m_lastSynthesisResult;
+
+  std::unique_ptr<PhraseAudioCache> m_phraseCache;
+
+  // Fixed cost of a phrase cache entry on top of its key and audio
+  const std::size_t PHRASE_CACHE_ENTRY_OVERHEAD = 128;
 };
 } // namespace piper
 
@@ -0,0 +1,103 @@
+#include "PromptTemplate.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+
+using namespace piper;
+
+namespace {
+
+// Samples at or below this level count as silence at segment joins
+const int SILENCE_THRESHOLD = 100;
+
+} // namespace
+
+std::vector<PromptTemplate::Segment> PromptTemplate::parse(const std::string& templateText) {
+  std::vector<Segment> segments;
+  Segment current;
+
+  for (std::size_t i = 0; i < templateText.size(); i++)
+  {
+    char c = templateText[i];
+    bool escaped = (i + 1 < templateText.size()) && (templateText[i + 1] == c);
+
+    if ((c == '{') && !escaped)
+    {
+      std::size_t end = templateText.find('}', i + 1);
+      if (end == std::string::npos)
+      {
+        throw std::runtime_error("Unterminated slot in template: " + templateText);
+      }
+
+      if (!current.text.empty())
+      {
+        segments.push_back(std::move(current));
+        current = Segment();
+      }
+
+      Segment slot;
+      slot.text = templateText.substr(i + 1, end - i - 1);
+      slot.isSlot = true;
+      if (slot.text.empty())
+      {
+        throw std::runtime_error("Empty slot name in template: " + templateText);
+      }
+
+      segments.push_back(std::move(slot));
+      i = end;
+    }
+    else if ((c == '}') && !escaped)
+    {
+      throw std::runtime_error("Unmatched '}' in template: " + templateText);
+    }
+    else
+    {
+      current.text.push_back(c);
+      if ((c == '{') || (c == '}'))
+      {
+        // Skip the second brace of the escape
+        i++;
+      }
+    }
+  }
+
+  if (!current.text.empty())
+  {
+    segments.push_back(std::move(current));
+  }
+
+  return segments;
+}
+
+void piper::trimSilence(std::vector<int16_t>& audio, bool trimStart, bool trimEnd) {
+  auto isSound = [](int16_t sample) { return std::abs(sample) > SILENCE_THRESHOLD; };
+
+  if (trimEnd)
+  {
+    auto lastSound = std::find_if(audio.rbegin(), audio.rend(), isSound);
+    audio.erase(lastSound.base(), audio.end());
+  }
+
+  if (trimStart)
+  {
+    auto firstSound = std::find_if(audio.begin(), audio.end(), isSound);
+    audio.erase(audio.begin(), firstSound);
+  }
+}
+
+void piper::appendWithCrossfade(std::vector<int16_t>& audioBuffer,
+                                const std::vector<int16_t>& audio,
+                                std::size_t crossfadeSamples) {
+  std::size_t overlap = std::min({crossfadeSamples, audioBuffer.size(), audio.size()});
+  std::size_t offset = audioBuffer.size() - overlap;
+
+  for (std::size_t i = 0; i < overlap; i++)
+  {
+    float fadeIn = (float) (i + 1) / (float) (overlap + 1);
+    float mixed = (audioBuffer[offset + i] * (1.0f - fadeIn)) + (audio[i] * fadeIn);
+    audioBuffer[offset + i] = static_cast<int16_t>(mixed);
+  }
+
+  audioBuffer.insert(audioBuffer.end(), audio.begin() + overlap, audio.end());
+}
@@ -0,0 +1,44 @@
+#ifndef PROMPT_TEMPLATE_H
+#define PROMPT_TEMPLATE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace piper {
+
+// Prompt with constant text and named slots, e.g. "The temperature in {city} is {n} degrees".
+// Created by PiperModel::prepareTemplate, which synthesizes the constant segments once.
+struct PromptTemplate
+{
+  struct Segment
+  {
+    // Constant text, or the slot name
+    std::string text;
+    bool isSlot = false;
+
+    // Audio of constant segments with silence at the joins trimmed off
+    std::vector<int16_t> audio;
+  };
+
+  std::vector<Segment> segments;
+
+  // Overlap between neighboring segments
+  std::size_t crossfadeSamples = 0;
+
+  // Splits text into constant segments and slots. "{{" and "}}" are literal braces.
+  static std::vector<Segment> parse(const std::string& templateText);
+};
+
+// Removes near-silent samples from the start and/or end of audio
+void trimSilence(std::vector<int16_t>& audio, bool trimStart, bool trimEnd);
+
+// Appends audio to audioBuffer, fading linearly from the last crossfadeSamples of audioBuffer into it
+void appendWithCrossfade(std::vector<int16_t>& audioBuffer,
+                         const std::vector<int16_t>& audio,
+                         std::size_t crossfadeSamples);
+
+} // namespace piper
+
+#endif // PROMPT_TEMPLATE_H
@@ -0,0 +1,54 @@
+#include "SoftLimiter.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "audio_kernels.hpp"
+
+using namespace piper;
+
+SoftLimiter::SoftLimiter(const SoftLimiterConfig& config, int sampleRate) : m_config(config) {
+  float lookaheadSamples = std::max(1.0f, config.lookaheadSeconds * sampleRate);
+  float releaseSamples = std::max(1.0f, config.releaseSeconds * sampleRate);
+
+  m_attackStep = 1.0f / lookaheadSamples;
+  m_releaseStep = 1.0f / releaseSamples;
+}
+
+void SoftLimiter::process(float* audio, std::size_t audioCount, float gain) const {
+  const AudioKernels& kernels = getAudioKernels();
+  kernels.scaleInPlace(audio, audioCount, gain);
+
+  // Nothing to do for most phrases when the gain is calibrated
+  if (kernels.peakAbs(audio, audioCount) <= m_config.threshold)
+  {
+    return;
+  }
+
+  // Gain each sample needs on its own
+  std::vector<float> envelope(audioCount);
+  for (std::size_t i = 0; i < audioCount; i++)
+  {
+    float level = std::abs(audio[i]);
+    envelope[i] = (level > m_config.threshold) ? (m_config.threshold / level) : 1.0f;
+  }
+
+  // Lookahead: ramp the gain down before each peak
+  for (std::size_t i = audioCount - 1; i > 0; i--)
+  {
+    envelope[i - 1] = std::min(envelope[i - 1], envelope[i] + m_attackStep);
+  }
+
+  // Release: ramp the gain back up after each peak.
+  // The envelope only ever decreases, so the threshold still holds.
+  for (std::size_t i = 1; i < audioCount; i++)
+  {
+    envelope[i] = std::min(envelope[i], envelope[i - 1] + m_releaseStep);
+  }
+
+  for (std::size_t i = 0; i < audioCount; i++)
+  {
+    audio[i] *= envelope[i];
+  }
+}
@@ -0,0 +1,44 @@
+#ifndef SOFT_LIMITER_H
+#define SOFT_LIMITER_H
+
+#include <cstddef>
+
+namespace piper {
+
+struct SoftLimiterConfig
+{
+  // Level the output never exceeds, relative to full scale
+  float threshold = 0.95f;
+
+  // Gain reduction ramps in over this time before a peak
+  float lookaheadSeconds = 0.005f;
+
+  // Time to recover from full gain reduction after a peak
+  float releaseSeconds = 0.05f;
+};
+
+// Applies a fixed gain and keeps the result under a threshold.
+// Each phrase is limited on its own: the whole phrase is known, so the lookahead adds no latency
+// and chunks can be emitted as soon as they are synthesized. Safe to call from multiple threads.
+class SoftLimiter
+{
+public:
+  SoftLimiter() = default;
+  SoftLimiter(const SoftLimiterConfig& config, int sampleRate);
+
+  // Scales audio by gain in place, then limits it
+  void process(float* audio, std::size_t audioCount, float gain) const;
+
+  float getThreshold() const { return m_config.threshold; }
+
+private:
+  SoftLimiterConfig m_config;
+
+  // Largest gain change per sample
+  float m_attackStep = 1.0f;
+  float m_releaseStep = 1.0f;
+};
+
+} // namespace piper
+
+#endif // SOFT_LIMITER_H
@@ -0,0 +1,334 @@
+#include "SpeechSession.hpp"
+
+#include <cctype>
+#include <spdlog/spdlog.h>
+#include <string>
+#include <utility>
+
+using namespace piper;
+
+namespace {
+
+const char* FULL_WIDTH_TERMINATORS[] = {"。", "？", "！", "，"};
+
+bool isTerminator(char c) { return (c == '.') || (c == '?') || (c == '!') || (c == ','); }
+
+bool isClosing(char c) { return (c == '"') || (c == '\'') || (c == ')') || (c == ']'); }
+
+bool isSpace(char c) { return std::isspace(static_cast<unsigned char>(c)) != 0; }
+
+std::string trim(const std::string& text) {
+  std::size_t first = 0;
+  while ((first < text.size()) && isSpace(text[first]))
+  {
+    first++;
+  }
+
+  std::size_t last = text.size();
+  while ((last > first) && isSpace(text[last - 1]))
+  {
+    last--;
+  }
+
+  return text.substr(first, last - first);
+}
+
+} // namespace
+
+std::size_t piper::findClauseEnd(const std::string& text, std::size_t start) {
+  for (std::size_t i = start; i < text.size(); i++)
+  {
+    if (isTerminator(text[i]))
+    {
+      // Runs like "?!" or "..." and closing quotes end together
+      std::size_t end = i + 1;
+      while ((end < text.size()) && (isTerminator(text[end]) || isClosing(text[end])))
+      {
+        end++;
+      }
+
+      if (end == text.size())
+      {
+        // Can't tell "3." from "3.14" yet
+        return std::string::npos;
+      }
+
+      if (!isSpace(text[end]))
+      {
+        i = end - 1;
+        continue;
+      }
+
+      // The clause is only handed on once the next one starts, so eSpeak's reading of the boundary is known
+      std::size_t next = end;
+      while ((next < text.size()) && isSpace(text[next]))
+      {
+        next++;
+      }
+
+      if (next == text.size())
+      {
+        return std::string::npos;
+      }
+
+      // eSpeak doesn't end a sentence at a period followed by a lowercase word or a number, e.g. "e.g. this"
+      bool continues = std::islower(static_cast<unsigned char>(text[next])) ||
+                       std::isdigit(static_cast<unsigned char>(text[next]));
+      if ((text[end - 1] == '.') && continues)
+      {
+        i = next - 1;
+        continue;
+      }
+
+      return end;
+    }
+
+    for (const char* terminator : FULL_WIDTH_TERMINATORS)
+    {
+      std::size_t length = std::char_traits<char>::length(terminator);
+      if (text.compare(i, length, terminator) == 0)
+      {
+        return i + length;
+      }
+    }
+  }
+
+  return std::string::npos;
+}
+
+SpeechSession::SpeechSession(PiperModel& model,
+                             const AudioCallback& audioCallback,
+                             const SpeechSessionConfig& config)
+    : m_model(model), m_audioCallback(audioCallback), m_config(config) {
+  m_thread = std::thread([this]() { run(); });
+}
+
+SpeechSession::~SpeechSession() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stopping = true;
+  }
+
+  m_changed.notify_one();
+  m_thread.join();
+}
+
+void SpeechSession::pushText(const std::string& text) {
+  rethrowError();
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_pendingText += text;
+
+    std::size_t clauseEnd = 0;
+    while ((clauseEnd = findClauseEnd(m_pendingText)) != std::string::npos)
+    {
+      enqueue(m_pendingText.substr(0, clauseEnd));
+      m_pendingText.erase(0, clauseEnd);
+    }
+
+    m_lastPushTime = std::chrono::steady_clock::now();
+    m_numPushes++;
+  }
+
+  m_changed.notify_one();
+}
+
+void SpeechSession::flush() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    enqueue(m_pendingText);
+    m_pendingText.clear();
+    m_numPushes++;
+  }
+
+  m_changed.notify_one();
+
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_idle.wait(lock, [this]() { return m_numUnfinished == 0; });
+  }
+
+  rethrowError();
+}
+
+std::string SpeechSession::getPendingText() const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_pendingText;
+}
+
+SpeculationStats SpeechSession::getSpeculationStats() const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_speculationStats;
+}
+
+// Must hold the lock
+void SpeechSession::enqueue(std::string clause) {
+  clause = trim(clause);
+  if (clause.empty())
+  {
+    return;
+  }
+
+  m_numUnfinished++;
+  m_clauses.push_back(std::move(clause));
+}
+
+void SpeechSession::rethrowError() {
+  std::exception_ptr error;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::swap(error, m_error);
+  }
+
+  if (error)
+  {
+    std::rethrow_exception(error);
+  }
+}
+
+void SpeechSession::run() {
+  auto idleGap = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+      std::chrono::duration<float>(m_config.speculationIdleSeconds));
+
+  // Each tail is speculated on at most once
+  uint64_t speculatedPushes = 0;
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (true)
+  {
+    if (!m_clauses.empty())
+    {
+      std::string clause = std::move(m_clauses.front());
+      m_clauses.pop_front();
+      speakClause(clause, lock);
+
+      m_numUnfinished--;
+      m_idle.notify_all();
+      continue;
+    }
+
+    // More text extended the tail past the speculation
+    std::string tail = trim(m_pendingText);
+    if (m_speculation && (m_speculation->text != tail))
+    {
+      discardSpeculation();
+    }
+
+    if (m_stopping)
+    {
+      break;
+    }
+
+    uint64_t numPushes = m_numPushes;
+    auto hasNews = [this, numPushes]() { return !m_clauses.empty() || m_stopping || (m_numPushes != numPushes); };
+
+    bool canSpeculate = m_config.speculative && !m_speculation && !m_error && !tail.empty() &&
+                        (speculatedPushes != numPushes);
+    if (!canSpeculate)
+    {
+      m_changed.wait(lock, hasNews);
+      continue;
+    }
+
+    if (m_changed.wait_until(lock, m_lastPushTime + idleGap, hasNews))
+    {
+      continue;
+    }
+
+    speculatedPushes = numPushes;
+    speculate(lock);
+  }
+}
+
+// Delivers the audio of a clause, from the speculation if it matches.
+// Called with the lock held; releases it while synthesizing.
+void SpeechSession::speakClause(const std::string& clause, std::unique_lock<std::mutex>& lock) {
+  std::unique_ptr<Speculation> speculation;
+  if (m_speculation && (m_speculation->text == clause))
+  {
+    m_speculationStats.hits++;
+    speculation = std::move(m_speculation);
+  }
+  else
+  {
+    discardSpeculation();
+  }
+
+  // Clauses queued behind a failed one are dropped until the error is reported
+  if (m_error)
+  {
+    return;
+  }
+
+  std::exception_ptr error;
+  lock.unlock();
+  try
+  {
+    if (speculation)
+    {
+      for (auto const& audioChunk : speculation->audioChunks)
+      {
+        m_audioCallback(audioChunk);
+      }
+    }
+    else
+    {
+      m_model.textToSpeech(clause, m_audioCallback);
+    }
+  }
+  catch (...)
+  {
+    error = std::current_exception();
+  }
+
+  lock.lock();
+  if (error)
+  {
+    m_error = error;
+  }
+}
+
+// Synthesizes the tail without delivering its audio.
+// Called with the lock held; releases it while synthesizing.
+void SpeechSession::speculate(std::unique_lock<std::mutex>& lock) {
+  auto speculation = std::make_unique<Speculation>();
+  speculation->text = trim(m_pendingText);
+
+  std::exception_ptr error;
+  lock.unlock();
+  try
+  {
+    m_model.textToSpeech(speculation->text, [&speculation](const std::vector<int16_t>& audioChunk) {
+      speculation->audioChunks.push_back(audioChunk);
+    });
+    speculation->inferSeconds = m_model.getLastSynthesisResult().inferSeconds;
+  }
+  catch (...)
+  {
+    // The clause is synthesized again when it is complete, which reports the error
+    error = std::current_exception();
+  }
+
+  lock.lock();
+  if (error)
+  {
+    spdlog::debug("Speculative synthesis failed for: {}", speculation->text);
+  }
+  else
+  {
+    spdlog::debug("Speculatively synthesized: {}", speculation->text);
+    m_speculation = std::move(speculation);
+  }
+}
+
+// Must hold the lock
+void SpeechSession::discardSpeculation() {
+  if (m_speculation)
+  {
+    spdlog::debug("Discarding speculative audio for: {}", m_speculation->text);
+    m_speculationStats.misses++;
+    m_speculationStats.wastedInferSeconds += m_speculation->inferSeconds;
+    m_speculation.reset();
+  }
+}
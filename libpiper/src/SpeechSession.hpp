@@ -0,0 +1,126 @@
+#ifndef SPEECH_SESSION_H
+#define SPEECH_SESSION_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "PiperModel.hpp"
+
+namespace piper {
+
+struct SpeechSessionConfig
+{
+  // Synthesize the unfinished tail ahead of time once no text arrived for speculationIdleSeconds.
+  // The audio is used if the tail turns out to be a whole clause, and discarded if more text extends it.
+  bool speculative = false;
+  float speculationIdleSeconds = 0.3f;
+};
+
+struct SpeculationStats
+{
+  // Speculative audio that was delivered
+  uint64_t hits = 0;
+
+  // Speculative audio that was discarded, and the inference time spent on it
+  uint64_t misses = 0;
+  double wastedInferSeconds = 0;
+};
+
+// Speaks text that arrives in pieces, e.g. tokens streamed from a language model.
+// Each clause is synthesized on a background thread as soon as the text after its terminator arrives,
+// while the unfinished tail is buffered until more text or flush().
+// Clauses are synthesized separately, so see findClauseEnd for where this differs from the whole text.
+//
+// The model must not be used by anything else while the session is alive.
+class SpeechSession
+{
+public:
+  // The callback is called on the session's thread, in order of the text
+  SpeechSession(PiperModel& model,
+                const AudioCallback& audioCallback,
+                const SpeechSessionConfig& config = SpeechSessionConfig());
+
+  // Clauses pushed before are still spoken
+  ~SpeechSession();
+
+  SpeechSession(const SpeechSession&) = delete;
+  SpeechSession& operator=(const SpeechSession&) = delete;
+
+  // Appends text and starts synthesizing every clause it completes.
+  // Rethrows an error of earlier synthesis.
+  void pushText(const std::string& text);
+
+  // Synthesizes the buffered tail and waits until all audio has been delivered
+  void flush();
+
+  // Text not yet handed to synthesis
+  std::string getPendingText() const;
+
+  SpeculationStats getSpeculationStats() const;
+
+private:
+  // Audio of the tail, synthesized before it was known to be a whole clause
+  struct Speculation
+  {
+    std::string text;
+    std::vector<std::vector<int16_t>> audioChunks;
+    double inferSeconds = 0;
+  };
+
+  void run();
+  void speakClause(const std::string& clause, std::unique_lock<std::mutex>& lock);
+  void speculate(std::unique_lock<std::mutex>& lock);
+  void discardSpeculation();
+  void enqueue(std::string clause);
+  void rethrowError();
+
+  PiperModel& m_model;
+  AudioCallback m_audioCallback;
+  SpeechSessionConfig m_config;
+
+  mutable std::mutex m_mutex;
+
+  // Wakes up the session's thread
+  std::condition_variable m_changed;
+
+  // Signaled when all clauses are spoken
+  std::condition_variable m_idle;
+
+  std::string m_pendingText;
+  std::chrono::steady_clock::time_point m_lastPushTime;
+  uint64_t m_numPushes = 0;
+
+  std::deque<std::string> m_clauses;
+  std::size_t m_numUnfinished = 0;
+  bool m_stopping = false;
+  std::exception_ptr m_error;
+
+  std::unique_ptr<Speculation> m_speculation;
+  SpeculationStats m_speculationStats;
+
+  std::thread m_thread;
+};
+
+// Returns the end of the first clause in text at or after start, or std::string::npos if there is none yet.
+// Clauses end after the terminators of addPunctuation ('.', '?', '!', ','), followed by whitespace
+// so "3.14" and "1,000" stay whole; closing quotes and brackets belong to the clause.
+// A clause only ends once the next one has started, and a period followed by a lowercase (ASCII) letter
+// or a digit doesn't end one, as in eSpeak.
+// Full-width terminators ('。', '？', '！', '，') end a clause without whitespace.
+//
+// eSpeak also knows abbreviations from its dictionaries, which this can't: "Dr. Smith" is split after "Dr.",
+// where eSpeak would read the whole text as one clause.
+std::size_t findClauseEnd(const std::string& text, std::size_t start = 0);
+
+} // namespace piper
+
+#endif // SPEECH_SESSION_H
@@ -1,55 +1,519 @@
 #include "Voice.hpp"
 
+#include <filesystem>
 #include <fstream>
+#include <iterator>
+#include <numeric>
 #include <sstream>
+#include <thread>
+
+#include "audio_kernels.hpp"
+#include "hash.hpp"
+#include "process_memory.hpp"
 
 using namespace piper;
 
-Voice::Voice(const std::string& modelPath, const std::string& modelConfigPath) {
+static std::basic_string<ORTCHAR_T> toOrtPath(const std::string& path) {
+  // Same conversion on Windows (wide) and everywhere else (narrow)
+  return std::basic_string<ORTCHAR_T>(path.begin(), path.end());
+}
+
+// Model and instruction set extensions of the CPU (empty where unknown)
+static std::string getCpuKey() {
+  static const std::string cpuKey = []() {
+    std::string key;
+#ifdef __linux__
+    // The first processor's entry; x86 has "model name" and "flags", ARM "CPU part" and "Features"
+    const char* fields[] = {"vendor_id", "model name", "flags", "CPU implementer", "CPU part", "Features"};
+    std::ifstream cpuInfo("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(cpuInfo, line) && !line.empty())
+    {
+      for (const char* field : fields)
+      {
+        if (line.compare(0, std::char_traits<char>::length(field), field) == 0)
+        {
+          key += line;
+          key.push_back('\n');
+        }
+      }
+    }
+#endif
+    return key;
+  }();
+
+  return cpuKey;
+}
+
+// Unique path next to path, so other processes never see a partial model
+static std::string getTempModelPath(const std::string& path) {
+  std::stringstream tempName;
+  tempName << path << ".tmp." << std::hash<std::thread::id>{}(std::this_thread::get_id()) << "."
+           << std::chrono::steady_clock::now().time_since_epoch().count();
+  return tempName.str();
+}
+
+Voice::Voice(const std::string& modelPath, const std::string& modelConfigPath, const VoiceOptions& options)
+    : voiceOptions(options), modelPath(modelPath),
+      memoryInfo(Ort::MemoryInfo::CreateCpu(OrtAllocatorType::OrtArenaAllocator, OrtMemType::OrtMemTypeDefault)) {
   std::string configPath = std::string(modelConfigPath);
   if (modelConfigPath == "")
   {
     configPath = std::string(modelPath) + ".json";
   }
   // Load Onnx model and JSON config file
-  spdlog::debug("Parsing voice config at {}", modelConfigPath);
-  std::ifstream modelConfigFile(modelConfigPath);
+  spdlog::debug("Parsing voice config at {}", configPath);
+  std::ifstream modelConfigFile(configPath);
   configRoot = json::parse(modelConfigFile);
+  configHash = fnv1a(configRoot.dump());
 
   parsePhonemizeConfig(configRoot, phonemizeConfig);
   parseSynthesisConfig(configRoot, synthesisConfig);
+  phonemeIdTable = std::make_shared<PhonemeIdTable>(phonemizeConfig.phonemeIdMap);
 
-  loadModel(modelPath);
+  limiter = SoftLimiter(voiceOptions.limiter, synthesisConfig.sampleRate);
+  if (voiceOptions.outputGain > 0)
+  {
+    outputGain = voiceOptions.outputGain;
+  }
+
+  // The quantized variant shares the config of the original model
+  if (voiceOptions.preferQuantized)
+  {
+    std::string quantizedPath = getQuantizedModelPath(modelPath);
+    if (std::filesystem::exists(quantizedPath))
+    {
+      spdlog::info("Using quantized model {}", quantizedPath);
+      this->modelPath = quantizedPath;
+    }
+    else
+    {
+      spdlog::debug("No quantized model at {}", quantizedPath);
+    }
+  }
+
+  if (voiceOptions.runtimeConfig)
+  {
+    OrtRuntime::configure(*voiceOptions.runtimeConfig);
+  }
+
+  loadModel(this->modelPath);
+}
+
+// <dir>/<name>.onnx -> <dir>/<name>.int8.onnx
+std::string Voice::getQuantizedModelPath(const std::string& modelPath) {
+  std::filesystem::path path(modelPath);
+  return (path.parent_path() / (path.stem().string() + ".int8" + path.extension().string())).string();
 }
 
 Voice::~Voice() {
   spdlog::debug("Destroying voice");
 }
 
+SessionProfile SessionProfile::fromName(const std::string& name) {
+  SessionProfile profile;
+  profile.name = name;
+
+  if (name == "default")
+  {
+    // Same as always: no graph optimizations, no arena
+  }
+  else if (name == "latency")
+  {
+    // Single request as fast as possible using all cores
+    profile.optimizationLevel = GraphOptimizationLevel::ORT_ENABLE_ALL;
+    profile.cpuMemArena = true;
+    profile.memPattern = true;
+    profile.allowSpinning = true;
+    profile.denormalAsZero = true;
+  }
+  else if (name == "throughput")
+  {
+    // Many concurrent requests, each on its own core
+    profile.optimizationLevel = GraphOptimizationLevel::ORT_ENABLE_ALL;
+    profile.cpuMemArena = true;
+    profile.memPattern = true;
+    profile.intraOpThreads = 1;
+    profile.interOpThreads = 1;
+    profile.allowSpinning = false;
+    profile.denormalAsZero = true;
+  }
+  else if (name == "low-memory")
+  {
+    // Small devices: no arena, no prepacked weight copies
+    profile.optimizationLevel = GraphOptimizationLevel::ORT_ENABLE_BASIC;
+    profile.prepacking = false;
+    profile.intraOpThreads = 1;
+    profile.interOpThreads = 1;
+    profile.allowSpinning = false;
+  }
+  else
+  {
+    throw std::runtime_error("Unknown session profile: " + name);
+  }
+
+  return profile;
+}
+
+std::string SessionProfile::toKey() const {
+  std::stringstream key;
+  key << name << ";opt=" << optimizationLevel << ";mode=" << executionMode << ";arena=" << cpuMemArena
+      << ";pattern=" << memPattern << ";prepack=" << prepacking << ";intra=" << intraOpThreads
+      << ";inter=" << interOpThreads << ";spin=" << allowSpinning << ";daz=" << denormalAsZero;
+
+  return key.str();
+}
+
+void Voice::applySessionProfile(const SessionProfile& profile, Ort::SessionOptions& options) {
+  spdlog::debug("Using session profile {}", profile.name);
+
+  options.SetGraphOptimizationLevel(profile.optimizationLevel);
+  options.SetExecutionMode(profile.executionMode);
+
+  if (profile.cpuMemArena)
+  {
+    options.EnableCpuMemArena();
+  }
+  else
+  {
+    options.DisableCpuMemArena();
+  }
+
+  if (profile.memPattern)
+  {
+    options.EnableMemPattern();
+  }
+  else
+  {
+    options.DisableMemPattern();
+  }
+
+  if (OrtRuntime::usesGlobalThreadPools())
+  {
+    // Thread count, spinning and denormals come from the runtime config
+    OrtRuntime::prepareSessionOptions(options);
+  }
+  else
+  {
+    if (profile.intraOpThreads > 0)
+    {
+      options.SetIntraOpNumThreads(profile.intraOpThreads);
+    }
+
+    if (profile.interOpThreads > 0)
+    {
+      options.SetInterOpNumThreads(profile.interOpThreads);
+    }
+
+    // See onnxruntime_session_options_config_keys.h
+    options.AddConfigEntry("session.intra_op.allow_spinning", profile.allowSpinning ? "1" : "0");
+    options.AddConfigEntry("session.inter_op.allow_spinning", profile.allowSpinning ? "1" : "0");
+    options.AddConfigEntry("session.set_denormal_as_zero", profile.denormalAsZero ? "1" : "0");
+  }
+
+  options.AddConfigEntry("session.disable_prepacking", profile.prepacking ? "0" : "1");
+
+  options.DisableProfiling();
+}
+
 void Voice::loadModel(const std::string& modelPath) {
-  spdlog::debug("Loading onnx model from {}", modelPath);
-  session.env = Ort::Env(OrtLoggingLevel::ORT_LOGGING_LEVEL_WARNING, "piper");
-  session.env.DisableTelemetryEvents();
+  std::size_t numReplicas = std::max<std::size_t>(1, voiceOptions.numReplicas);
 
-  session.options.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_DISABLE_ALL);
+  // Load a previously optimized model or save the optimized graph first
+  std::string loadPath = modelPath;
+  if (voiceOptions.cacheOptimizedModel)
+  {
+    std::error_code existsError;
+    std::string cachePath = getOptimizedModelCachePath();
+    if (cachePath.empty())
+    {
+      spdlog::warn("Not caching the optimized model of {}", modelPath);
+    }
+    else if (std::filesystem::exists(cachePath, existsError))
+    {
+      spdlog::debug("Using cached optimized model {}", cachePath);
+      loadPath = cachePath;
+    }
+    else if (saveOptimizedModel(modelPath, cachePath))
+    {
+      spdlog::debug("Cached optimized model at {}", cachePath);
+      loadPath = cachePath;
+    }
+  }
+
+  bool shareWeights = voiceOptions.shareReplicaWeights && (numReplicas > 1);
+  if (shareWeights)
+  {
+    prepackedWeights = std::make_unique<Ort::PrepackedWeightsContainer>();
+  }
+
+  if (shareWeights && (std::filesystem::path(loadPath).extension() != ".ort"))
+  {
+    spdlog::debug("Replicas share prepacked weights only; cacheOptimizedModel also shares initializers");
+  }
+
+  for (std::size_t replicaIdx = 0; replicaIdx < numReplicas; replicaIdx++)
+  {
+    spdlog::debug("Loading onnx model from {} (replica {}/{})", loadPath, replicaIdx + 1, numReplicas);
+    std::size_t residentBytesBefore = getResidentMemoryBytes();
+    auto session = std::make_unique<ModelSession>();
+
+    applySessionProfile(voiceOptions.sessionProfile, session->options);
+
+    if ((loadPath != modelPath) && (voiceOptions.sessionProfile.optimizationLevel <= getSavedOptimizationLevel()))
+    {
+      // Graph is already optimized
+      session->options.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_DISABLE_ALL);
+    }
 
-  session.options.DisableCpuMemArena();
-  session.options.DisableMemPattern();
-  session.options.DisableProfiling();
+    auto startTime = std::chrono::steady_clock::now();
 
+    bool isOrtFormat = std::filesystem::path(loadPath).extension() == ".ort";
+    const void* loadBytes = nullptr;
+    std::size_t loadSize = 0;
+    if (voiceOptions.memoryMapModel)
+    {
+      if (mappedModels.empty() || (mappedModels.back()->path() != loadPath))
+      {
+        spdlog::debug("Memory mapping {}", loadPath);
+        mappedModels.push_back(std::make_unique<MappedFile>(loadPath));
+      }
+
+      loadBytes = mappedModels.back()->data();
+      loadSize = mappedModels.back()->size();
+    }
+    else if (shareWeights && isOrtFormat)
+    {
+      if (modelBytes.empty())
+      {
+        std::ifstream modelFile(loadPath, std::ios::binary);
+        if (!modelFile)
+        {
+          throw std::runtime_error("Failed to open model: " + loadPath);
+        }
+
+        modelBytes.assign(std::istreambuf_iterator<char>(modelFile), std::istreambuf_iterator<char>());
+      }
+
+      loadBytes = modelBytes.data();
+      loadSize = modelBytes.size();
+    }
+
+    if (loadBytes && isOrtFormat)
+    {
+      // Use the bytes in place (including initializers) instead of copying them
+      session->options.AddConfigEntry("session.use_ort_model_bytes_directly", "1");
+      session->options.AddConfigEntry("session.use_ort_model_bytes_for_initializers", "1");
+    }
+
+    if (loadBytes && shareWeights)
+    {
+      session->onnx = Ort::Session(OrtRuntime::getEnv(), loadBytes, loadSize, session->options, *prepackedWeights);
+    }
+    else if (loadBytes)
+    {
+      session->onnx = Ort::Session(OrtRuntime::getEnv(), loadBytes, loadSize, session->options);
+    }
+    else if (shareWeights)
+    {
+      auto loadPathStr = toOrtPath(loadPath);
+      session->onnx = Ort::Session(OrtRuntime::getEnv(), loadPathStr.c_str(), session->options, *prepackedWeights);
+    }
+    else
+    {
+      auto loadPathStr = toOrtPath(loadPath);
+      session->onnx = Ort::Session(OrtRuntime::getEnv(), loadPathStr.c_str(), session->options);
+    }
+
+    auto endTime = std::chrono::steady_clock::now();
+    double loadSeconds = std::chrono::duration<double>(endTime - startTime).count();
+
+    // A replica that adds (almost) nothing shares its weights with the others
+    std::size_t residentBytesAfter = getResidentMemoryBytes();
+    if ((residentBytesBefore > 0) && (residentBytesAfter > 0))
+    {
+      spdlog::info("Loaded onnx model in {} second(s) (replica {}/{} added {:.1f} MiB, resident: {:.1f} MiB)",
+                   loadSeconds,
+                   replicaIdx + 1,
+                   numReplicas,
+                   ((double) residentBytesAfter - (double) residentBytesBefore) / (1024.0 * 1024.0),
+                   residentBytesAfter / (1024.0 * 1024.0));
+    }
+    else
+    {
+      spdlog::info("Loaded onnx model in {} second(s) (replica {}/{})", loadSeconds, replicaIdx + 1, numReplicas);
+    }
+
+    sessions.push_back(std::move(session));
+  }
+
+  // Only exports with the audio length of each row can be batched
+  ModelSession& session = *sessions.front();
+  for (std::size_t outputIdx = 0; outputIdx < session.onnx.GetOutputCount(); outputIdx++)
+  {
+    std::string outputName = session.onnx.GetOutputNameAllocated(outputIdx, session.allocator).get();
+    if (outputName == OUTPUT_LENGTHS_NAME)
+    {
+      spdlog::debug("Using model output {} for batched audio lengths", outputName);
+      outputLengthsName = outputName;
+    }
+  }
+}
+
+bool Voice::saveOptimizedModel(const std::string& sourcePath, const std::string& ortPath) {
+  spdlog::debug("Saving onnx model {} in ORT format to {}", sourcePath, ortPath);
   auto startTime = std::chrono::steady_clock::now();
 
-#ifdef _WIN32
-  auto modelPathW = std::wstring(modelPath.begin(), modelPath.end());
-  auto modelPathStr = modelPathW.c_str();
-#else
-  auto modelPathStr = modelPath.c_str();
-#endif
+  std::string tempPath = getTempModelPath(ortPath);
+  auto tempPathStr = toOrtPath(tempPath);
+
+  Ort::SessionOptions options;
+  applySessionProfile(voiceOptions.sessionProfile, options);
+  options.SetGraphOptimizationLevel(getSavedOptimizationLevel());
+  options.SetOptimizedModelFilePath(tempPathStr.c_str());
+  options.AddConfigEntry("session.save_model_format", "ORT");
+
+  try
+  {
+    // Only created for the saved model
+    auto sourcePathStr = toOrtPath(sourcePath);
+    Ort::Session session(OrtRuntime::getEnv(), sourcePathStr.c_str(), options);
+  }
+  catch (const std::exception& e)
+  {
+    // e.g. a read-only directory or a full disk; the original model is loaded instead
+    spdlog::warn("Failed to save ORT format model at {}: {}", ortPath, e.what());
+    std::error_code removeError;
+    std::filesystem::remove(tempPath, removeError);
+    return false;
+  }
 
-  session.onnx = Ort::Session(session.env, modelPathStr, session.options);
+  std::error_code renameError;
+  std::filesystem::rename(tempPath, ortPath, renameError);
+  if (renameError)
+  {
+    spdlog::warn("Failed to save ORT format model at {}: {}", ortPath, renameError.message());
+    std::filesystem::remove(tempPath, renameError);
+    return false;
+  }
 
   auto endTime = std::chrono::steady_clock::now();
-  spdlog::debug("Loaded onnx model in {} second(s)", std::chrono::duration<double>(endTime - startTime).count());
+  spdlog::debug("Saved ORT format model in {} second(s)", std::chrono::duration<double>(endTime - startTime).count());
+  return true;
+}
+
+uint64_t Voice::getModelHash() {
+  if (modelHash)
+  {
+    return *modelHash;
+  }
+
+  // Stored next to the optimized models, so later loads of the same file don't read all of it
+  std::string hashPath;
+  if (voiceOptions.cacheOptimizedModel)
+  {
+    hashPath = getModelCachePath(".hash");
+  }
+
+  if (!hashPath.empty())
+  {
+    std::ifstream hashFile(hashPath);
+    std::string hashHex;
+    if (hashFile >> hashHex)
+    {
+      try
+      {
+        modelHash = std::stoull(hashHex, nullptr, 16);
+        return *modelHash;
+      }
+      catch (const std::logic_error&)
+      {
+        spdlog::warn("Ignoring invalid model hash in {}", hashPath);
+      }
+    }
+  }
+
+  auto startTime = std::chrono::steady_clock::now();
+  modelHash = fnv1aFile(modelPath);
+  auto endTime = std::chrono::steady_clock::now();
+  spdlog::debug("Hashed onnx model in {} second(s)", std::chrono::duration<double>(endTime - startTime).count());
+
+  if (!hashPath.empty())
+  {
+    std::string tempPath = getTempModelPath(hashPath);
+    {
+      std::ofstream hashFile(tempPath);
+      hashFile << hashToHex(*modelHash) << std::endl;
+    }
+
+    std::error_code renameError;
+    std::filesystem::rename(tempPath, hashPath, renameError);
+    if (renameError)
+    {
+      spdlog::debug("Failed to store model hash at {}: {}", hashPath, renameError.message());
+      std::filesystem::remove(tempPath, renameError);
+    }
+  }
+
+  return *modelHash;
+}
+
+// <cache dir>/<model name>.<key><extension>, keyed by the model file's path, size and modification time.
+// Empty if the model file or the cache directory can't be accessed.
+std::string Voice::getModelCachePath(const std::string& extension) {
+  std::error_code error;
+  std::filesystem::path absolutePath = std::filesystem::absolute(modelPath, error);
+  uint64_t fileSize = error ? 0 : std::filesystem::file_size(absolutePath, error);
+  auto modifiedAt = error ? std::filesystem::file_time_type() : std::filesystem::last_write_time(absolutePath, error);
+  if (error)
+  {
+    spdlog::warn("Can't cache data of {}: {}", modelPath, error.message());
+    return "";
+  }
+
+  int64_t modifiedTime = modifiedAt.time_since_epoch().count();
+
+  uint64_t fileKey = fnv1a(absolutePath.string());
+  fileKey = fnv1a(&fileSize, sizeof(fileSize), fileKey);
+  fileKey = fnv1a(&modifiedTime, sizeof(modifiedTime), fileKey);
+
+  std::filesystem::path cacheDir = voiceOptions.optimizedModelCacheDir;
+  if (cacheDir.empty())
+  {
+    cacheDir = absolutePath.parent_path();
+  }
+
+  std::filesystem::create_directories(cacheDir, error);
+  if (error)
+  {
+    spdlog::warn("Can't create cache directory {}: {}", cacheDir.string(), error.message());
+    return "";
+  }
+
+  std::string cacheName = absolutePath.stem().string() + "." + hashToHex(fileKey) + extension;
+  return (cacheDir / cacheName).string();
+}
+
+// <cache dir>/<model name>.<key>.<ort key>.ort
+std::string Voice::getOptimizedModelCachePath() {
+  uint64_t ortKey = fnv1a(std::string(OrtGetApiBase()->GetVersionString()));
+  ortKey = fnv1a(voiceOptions.sessionProfile.toKey(), ortKey);
+  ortKey = fnv1a(getCpuKey(), ortKey);
+
+  return getModelCachePath("." + hashToHex(ortKey) + ".ort");
+}
+
+// Graphs saved with ORT_ENABLE_ALL contain layout optimizations for the CPU they were optimized on.
+// onnxruntime doesn't optimize ORT format models again when loading them, so the full level is only saved
+// where the CPU is part of the cache key.
+GraphOptimizationLevel Voice::getSavedOptimizationLevel() {
+  GraphOptimizationLevel level = voiceOptions.sessionProfile.optimizationLevel;
+  if (getCpuKey().empty())
+  {
+    level = std::min(level, GraphOptimizationLevel::ORT_ENABLE_EXTENDED);
+  }
+
+  return level;
 }
 
 // Load JSON config information for phonemization
@@ -182,18 +646,243 @@ void Voice::parseSynthesisConfig(json& configRoot, SynthesisConfig& synthesisCon
 
 // Phoneme ids to WAV audio
 void Voice::synthesize(std::vector<int16_t>& audioBuffer, std::vector<PhonemeId>& phonemeIds, SynthesisResult& result) {
+  infer(phonemeIds, result, [this, &audioBuffer](float* audio, std::size_t audioCount) {
+    convertAudio(audio, audioCount, audioBuffer);
+  });
+}
+
+// Phoneme ids to float audio, straight from the output tensor
+void Voice::synthesize(std::vector<PhonemeId>& phonemeIds,
+                       SynthesisResult& result,
+                       const FloatAudioCallback& audioCallback) {
+  infer(phonemeIds, result, [this, &audioCallback](float* audio, std::size_t audioCount) {
+    normalizeAudio(audio, audioCount);
+    audioCallback(audio, audioCount);
+  });
+}
+
+// Runs inference on an idle context and hands the output audio to handleAudio before the context is reused
+template <typename AudioHandler>
+void Voice::infer(std::vector<PhonemeId>& phonemeIds, SynthesisResult& result, AudioHandler handleAudio) {
+  std::unique_ptr<SynthesisContext> context = acquireSynthesisContext();
+
+  try
+  {
+    infer(phonemeIds, result, *context);
+    handleAudio(context->outputTensor.GetTensorMutableData<float>(), context->audioCount);
+  }
+  catch (...)
+  {
+    context->outputTensor = Ort::Value(nullptr);
+    releaseSynthesisContext(std::move(context));
+    throw;
+  }
+
+  // Return the output to onnxruntime
+  context->outputTensor = Ort::Value(nullptr);
+  releaseSynthesisContext(std::move(context));
+}
+
+// Phoneme ids to raw audio in context.outputTensor
+void Voice::infer(std::vector<PhonemeId>& phonemeIds, SynthesisResult& result, SynthesisContext& context) {
   spdlog::debug("Synthesizing audio for {} phoneme id(s)", phonemeIds.size());
 
-  auto memoryInfo = Ort::MemoryInfo::CreateCpu(OrtAllocatorType::OrtArenaAllocator, OrtMemType::OrtMemTypeDefault);
+  if (phonemeIds.size() > context.phonemeIds.size())
+  {
+    // Grow buffer; existing tensors point to the old one
+    context.phonemeIds.resize(phonemeIds.size());
+    context.phonemeIdTensors.clear();
+  }
+
+  std::copy(phonemeIds.begin(), phonemeIds.end(), context.phonemeIds.begin());
+  context.phonemeIdLengths[0] = phonemeIds.size();
+  context.scales = {synthesisConfig.noiseScale, synthesisConfig.lengthScale, synthesisConfig.noiseW};
+
+  if (context.phonemeIdTensors.size() <= phonemeIds.size())
+  {
+    context.phonemeIdTensors.resize(context.phonemeIds.size() + 1);
+  }
+
+  Ort::Value& phonemeIdsTensor = context.phonemeIdTensors[phonemeIds.size()];
+  if (!phonemeIdsTensor)
+  {
+    std::array<int64_t, 2> phonemeIdsShape{1, (int64_t) phonemeIds.size()};
+    phonemeIdsTensor = Ort::Value::CreateTensor<int64_t>(
+        memoryInfo, context.phonemeIds.data(), phonemeIds.size(), phonemeIdsShape.data(), phonemeIdsShape.size());
+  }
+
+  // From export_onnx.py
+  static const char* const INPUT_NAMES[] = {"input", "input_lengths", "scales"};
+  static const char* const OUTPUT_NAMES[] = {"output"};
+  const OrtValue* inputTensors[] = {phonemeIdsTensor, context.phonemeIdLengthsTensor, context.scalesTensor};
+
+  // The C API takes the inputs by pointer and writes the output into the context without temporary vectors.
+  // The output itself is allocated by onnxruntime (see SynthesisContext::outputTensor).
+  context.outputTensor = Ort::Value(nullptr);
+  OrtValue* outputTensor = nullptr;
+
+  // Infer
+  auto startTime = std::chrono::steady_clock::now();
+  Ort::ThrowOnError(Ort::GetApi().Run(context.session->onnx,
+                                      nullptr,
+                                      INPUT_NAMES,
+                                      inputTensors,
+                                      std::size(inputTensors),
+                                      OUTPUT_NAMES,
+                                      std::size(OUTPUT_NAMES),
+                                      &outputTensor));
+  auto endTime = std::chrono::steady_clock::now();
+
+  context.outputTensor = Ort::Value(outputTensor);
+  if (!context.outputTensor || !context.outputTensor.IsTensor())
+  {
+    throw std::runtime_error("Invalid output tensors");
+  }
+  auto inferDuration = std::chrono::duration<double>(endTime - startTime);
+  result.inferSeconds = inferDuration.count();
+
+  context.audioCount = context.outputTensor.GetTensorTypeAndShapeInfo().GetElementCount();
+
+  result.audioSeconds = (double) context.audioCount / (double) synthesisConfig.sampleRate;
+  result.realTimeFactor = 0.0;
+  if (result.audioSeconds > 0)
+  {
+    result.realTimeFactor = result.inferSeconds / result.audioSeconds;
+  }
+  spdlog::debug("Synthesized {} second(s) of audio in {} second(s)", result.audioSeconds, result.inferSeconds);
+}
+
+// Reuse an idle context or create one on the next session replica
+std::unique_ptr<SynthesisContext> Voice::acquireSynthesisContext() {
+  {
+    std::lock_guard<std::mutex> lock(contextMutex);
+    if (!idleContexts.empty())
+    {
+      auto context = std::move(idleContexts.back());
+      idleContexts.pop_back();
+      return context;
+    }
+  }
+
+  auto context = std::make_unique<SynthesisContext>();
+
+  // Spread concurrent callers over the session replicas
+  context->session = sessions[nextSession.fetch_add(1, std::memory_order_relaxed) % sessions.size()].get();
+
+  // Enough for a phrase of MAX_PHONEMES with interspersed padding
+  context->phonemeIds.resize(2 * MAX_PHONEMES + 3);
+
+  std::array<int64_t, 1> phonemeIdLengthsShape{(int64_t) context->phonemeIdLengths.size()};
+  context->phonemeIdLengthsTensor = Ort::Value::CreateTensor<int64_t>(memoryInfo,
+                                                                      context->phonemeIdLengths.data(),
+                                                                      context->phonemeIdLengths.size(),
+                                                                      phonemeIdLengthsShape.data(),
+                                                                      phonemeIdLengthsShape.size());
+
+  std::array<int64_t, 1> scalesShape{(int64_t) context->scales.size()};
+  context->scalesTensor = Ort::Value::CreateTensor<float>(
+      memoryInfo, context->scales.data(), context->scales.size(), scalesShape.data(), scalesShape.size());
+
+  return context;
+}
+
+void Voice::releaseSynthesisContext(std::unique_ptr<SynthesisContext> context) {
+  std::lock_guard<std::mutex> lock(contextMutex);
+  idleContexts.push_back(std::move(context));
+}
+
+// Batches of phoneme ids to WAV audio
+void Voice::synthesizeBatch(std::vector<std::vector<int16_t>>& audioBuffers,
+                            const std::vector<std::vector<PhonemeId>>& phonemeIds,
+                            std::vector<SynthesisResult>& results,
+                            std::size_t maxBatchSize) {
+  audioBuffers.resize(phonemeIds.size());
+  results.resize(phonemeIds.size());
+  maxBatchSize = std::max<std::size_t>(1, maxBatchSize);
+
+  std::vector<std::size_t> order;
+  for (std::size_t rowIdx = 0; rowIdx < phonemeIds.size(); rowIdx++)
+  {
+    results[rowIdx] = SynthesisResult{};
+    if (!phonemeIds[rowIdx].empty())
+    {
+      order.push_back(rowIdx);
+    }
+  }
+
+  if (!outputLengthsName)
+  {
+    // Rows of a batch get different predicted durations, and the decoder pads their audio to the longest.
+    // Without the audio length of each row, that padding can't be cut, so each row is synthesized on its own.
+    for (std::size_t rowIdx : order)
+    {
+      std::vector<PhonemeId> rowIds = phonemeIds[rowIdx];
+      synthesize(audioBuffers[rowIdx], rowIds, results[rowIdx]);
+    }
+
+    return;
+  }
+
+  // Sort by length so each batch needs as little padding as possible
+  std::stable_sort(order.begin(), order.end(), [&phonemeIds](std::size_t a, std::size_t b) {
+    return phonemeIds[a].size() < phonemeIds[b].size();
+  });
+
+  std::size_t batchStart = 0;
+  while (batchStart < order.size())
+  {
+    std::size_t batchEnd = batchStart + 1;
+    std::size_t idCount = phonemeIds[order[batchStart]].size();
+    while ((batchEnd < order.size()) && ((batchEnd - batchStart) < maxBatchSize))
+    {
+      // Rows are sorted, so the next row determines the padded length
+      std::size_t nextCount = phonemeIds[order[batchEnd]].size();
+      std::size_t paddedCount = nextCount * (batchEnd - batchStart + 1);
+      if (paddedCount > (idCount + nextCount) * (1.0f + MAX_BATCH_PADDING))
+      {
+        break;
+      }
+
+      idCount += nextCount;
+      batchEnd++;
+    }
+
+    std::vector<std::size_t> rowIndices(order.begin() + batchStart, order.begin() + batchEnd);
+    synthesizeRows(audioBuffers, phonemeIds, results, rowIndices);
+    batchStart = batchEnd;
+  }
+}
+
+// One padded [B, T] onnx run
+void Voice::synthesizeRows(std::vector<std::vector<int16_t>>& audioBuffers,
+                           const std::vector<std::vector<PhonemeId>>& phonemeIds,
+                           std::vector<SynthesisResult>& results,
+                           const std::vector<std::size_t>& rowIndices) {
+  int64_t batchSize = rowIndices.size();
+  int64_t maxLength = 0;
+  for (auto rowIdx : rowIndices)
+  {
+    maxLength = std::max(maxLength, (int64_t) phonemeIds[rowIdx].size());
+  }
+
+  spdlog::debug("Synthesizing audio for batch of {} x {} phoneme id(s)", batchSize, maxLength);
 
   // Allocate
-  std::vector<int64_t> phonemeIdLengths{(int64_t) phonemeIds.size()};
+  std::vector<PhonemeId> batchIds(batchSize * maxLength, phonemizeConfig.idPad);
+  std::vector<int64_t> phonemeIdLengths;
+  for (int64_t row = 0; row < batchSize; row++)
+  {
+    auto& rowIds = phonemeIds[rowIndices[row]];
+    std::copy(rowIds.begin(), rowIds.end(), batchIds.begin() + (row * maxLength));
+    phonemeIdLengths.push_back(rowIds.size());
+  }
+
   std::vector<float> scales{synthesisConfig.noiseScale, synthesisConfig.lengthScale, synthesisConfig.noiseW};
 
   std::vector<Ort::Value> inputTensors;
-  std::vector<int64_t> phonemeIdsShape{1, (int64_t) phonemeIds.size()};
+  std::vector<int64_t> phonemeIdsShape{batchSize, maxLength};
   inputTensors.push_back(Ort::Value::CreateTensor<int64_t>(
-      memoryInfo, phonemeIds.data(), phonemeIds.size(), phonemeIdsShape.data(), phonemeIdsShape.size()));
+      memoryInfo, batchIds.data(), batchIds.size(), phonemeIdsShape.data(), phonemeIdsShape.size()));
 
   std::vector<int64_t> phomemeIdLengthsShape{(int64_t) phonemeIdLengths.size()};
   inputTensors.push_back(Ort::Value::CreateTensor<int64_t>(memoryInfo,
@@ -207,8 +896,10 @@ void Voice::synthesize(std::vector<int16_t>& audioBuffer, std::vector<PhonemeId>
       memoryInfo, scales.data(), scales.size(), scalesShape.data(), scalesShape.size()));
 
   // From export_onnx.py
-  std::array<const char*, 4> inputNames = {"input", "input_lengths", "scales", "sid"};
-  std::array<const char*, 1> outputNames = {"output"};
+  std::array<const char*, 3> inputNames = {"input", "input_lengths", "scales"};
+  std::array<const char*, 2> outputNames = {"output", outputLengthsName->c_str()};
+
+  ModelSession& session = *sessions[nextSession.fetch_add(1, std::memory_order_relaxed) % sessions.size()];
 
   // Infer
   auto startTime = std::chrono::steady_clock::now();
@@ -220,50 +911,45 @@ void Voice::synthesize(std::vector<int16_t>& audioBuffer, std::vector<PhonemeId>
                                         outputNames.size());
   auto endTime = std::chrono::steady_clock::now();
 
-  if ((outputTensors.size() != 1) || (!outputTensors.front().IsTensor()))
+  if ((outputTensors.size() != outputNames.size()) || (!outputTensors.front().IsTensor()))
   {
     throw std::runtime_error("Invalid output tensors");
   }
-  auto inferDuration = std::chrono::duration<double>(endTime - startTime);
-  result.inferSeconds = inferDuration.count();
+  double inferSeconds = std::chrono::duration<double>(endTime - startTime).count();
 
-  const float* audio = outputTensors.front().GetTensorData<float>();
+  // batch x 1 x samples
+  float* audio = outputTensors.front().GetTensorMutableData<float>();
   auto audioShape = outputTensors.front().GetTensorTypeAndShapeInfo().GetShape();
-  int64_t audioCount = audioShape[audioShape.size() - 1];
+  int64_t rowStride = audioShape[audioShape.size() - 1];
 
-  result.audioSeconds = (double) audioCount / (double) synthesisConfig.sampleRate;
-  result.realTimeFactor = 0.0;
-  if (result.audioSeconds > 0)
+  // Each row's audio is padded to the longest row of the batch
+  std::vector<int64_t> audioCounts(batchSize);
+  const int64_t* audioLengths = outputTensors[1].GetTensorData<int64_t>();
+  for (int64_t row = 0; row < batchSize; row++)
   {
-    result.realTimeFactor = result.inferSeconds / result.audioSeconds;
+    audioCounts[row] = std::clamp<int64_t>(audioLengths[row], 0, rowStride);
   }
-  spdlog::debug("Synthesized {} second(s) of audio in {} second(s)", result.audioSeconds, result.inferSeconds);
 
-  // Get max audio value for scaling
-  float maxAudioValue = 0.01f;
-  for (int64_t i = 0; i < audioCount; i++)
+  int64_t totalAudioCount = std::accumulate(audioCounts.begin(), audioCounts.end(), (int64_t) 0);
+  for (int64_t row = 0; row < batchSize; row++)
   {
-    float audioValue = abs(audio[i]);
-    if (audioValue > maxAudioValue)
+    std::size_t rowIdx = rowIndices[row];
+    SynthesisResult& result = results[rowIdx];
+
+    // Batch inference time is shared in proportion to the audio produced
+    result.audioSeconds = (double) audioCounts[row] / (double) synthesisConfig.sampleRate;
+    result.inferSeconds = (totalAudioCount > 0) ? (inferSeconds * audioCounts[row] / totalAudioCount) : 0.0;
+    result.realTimeFactor = 0.0;
+    if (result.audioSeconds > 0)
     {
-      maxAudioValue = audioValue;
+      result.realTimeFactor = result.inferSeconds / result.audioSeconds;
     }
-  }
-
-  // We know the size up front
-  audioBuffer.reserve(audioCount);
 
-  // Scale audio to fill range and convert to int16
-  float audioScale = (MAX_WAV_VALUE / std::max(0.01f, maxAudioValue));
-  for (int64_t i = 0; i < audioCount; i++)
-  {
-    int16_t intAudioValue = static_cast<int16_t>(std::clamp(audio[i] * audioScale,
-                                                            static_cast<float>(std::numeric_limits<int16_t>::min()),
-                                                            static_cast<float>(std::numeric_limits<int16_t>::max())));
-
-    audioBuffer.push_back(intAudioValue);
+    convertAudio(audio + (row * rowStride), audioCounts[row], audioBuffers[rowIdx]);
   }
 
+  spdlog::debug("Synthesized batch of {} in {} second(s)", batchSize, inferSeconds);
+
   // Clean up
   for (std::size_t i = 0; i < outputTensors.size(); i++)
   {
@@ -274,4 +960,52 @@ void Voice::synthesize(std::vector<int16_t>& audioBuffer, std::vector<PhonemeId>
   {
     Ort::detail::OrtRelease(inputTensors[i].release());
   }
-}
\ No newline at end of file
+}
+
+// Normalize float audio and append it as int16
+void Voice::convertAudio(float* audio, int64_t audioCount, std::vector<int16_t>& audioBuffer) {
+  if (voiceOptions.normalization == AudioNormalization::PhrasePeak)
+  {
+    normalizeToInt16(audio, audioCount, 0.01f, MAX_WAV_VALUE, audioBuffer);
+    return;
+  }
+
+  limiter.process(audio, audioCount, outputGain);
+
+  std::size_t offset = audioBuffer.size();
+  audioBuffer.resize(offset + audioCount);
+  getAudioKernels().scaleToInt16(audio, audioCount, MAX_WAV_VALUE, audioBuffer.data() + offset);
+}
+
+// Normalize float audio to [-1, 1] in place
+void Voice::normalizeAudio(float* audio, std::size_t audioCount) {
+  if (voiceOptions.normalization == AudioNormalization::PhrasePeak)
+  {
+    const AudioKernels& kernels = getAudioKernels();
+    float maxAudioValue = std::max(0.01f, kernels.peakAbs(audio, audioCount));
+    kernels.scaleInPlace(audio, audioCount, 1.0f / maxAudioValue);
+    return;
+  }
+
+  limiter.process(audio, audioCount, outputGain);
+}
+
+void Voice::calibrateOutputGain(std::vector<std::vector<PhonemeId>>& referencePhonemeIds) {
+  float maxAudioValue = 0.0f;
+  for (auto& phonemeIds : referencePhonemeIds)
+  {
+    SynthesisResult result;
+    infer(phonemeIds, result, [&maxAudioValue](float* audio, std::size_t audioCount) {
+      maxAudioValue = std::max(maxAudioValue, getAudioKernels().peakAbs(audio, audioCount));
+    });
+  }
+
+  if (maxAudioValue <= 0.01f)
+  {
+    spdlog::warn("Reference phrases are silent, keeping output gain {}", outputGain);
+    return;
+  }
+
+  outputGain = CALIBRATION_PEAK * limiter.getThreshold() / maxAudioValue;
+  spdlog::debug("Calibrated output gain: {} (reference peak {})", outputGain, maxAudioValue);
+}
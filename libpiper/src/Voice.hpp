@@ -1,13 +1,21 @@
 #ifndef VOICE_H
 #define VOICE_H
 
+#include <array>
+#include <atomic>
+#include <functional>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <onnxruntime_cxx_api.h>
 #include <optional>
 #include <spdlog/spdlog.h>
 #include <string>
 #include <vector>
 
+#include "MappedFile.hpp"
+#include "OrtRuntime.hpp"
+#include "SoftLimiter.hpp"
 #include "json.hpp"
 #include "phoneme_ids.hpp"
 #include "phonemize.hpp"
@@ -54,29 +62,150 @@ struct SynthesisResult
   double realTimeFactor;
 };
 
+// Receives normalized float samples in [-1, 1] (see AudioNormalization).
+// The samples point into the output tensor and are only valid during the call.
+typedef std::function<void(const float* audio, std::size_t audioCount)> FloatAudioCallback;
+
 struct ModelSession
 {
   Ort::Session onnx;
   Ort::AllocatorWithDefaultOptions allocator;
   Ort::SessionOptions options;
-  Ort::Env env;
 
   ModelSession() : onnx(nullptr){};
 };
 
+// onnxruntime session settings.
+// Presets are available by name, see SessionProfile::fromName.
+struct SessionProfile
+{
+  std::string name = "default";
+
+  GraphOptimizationLevel optimizationLevel = GraphOptimizationLevel::ORT_DISABLE_ALL;
+  ExecutionMode executionMode = ExecutionMode::ORT_SEQUENTIAL;
+  bool cpuMemArena = false;
+  bool memPattern = false;
+  bool prepacking = true;
+
+  // 0 lets onnxruntime decide.
+  // Ignored when the runtime uses global thread pools, which is the default (see RuntimeConfig).
+  int intraOpThreads = 0;
+  int interOpThreads = 0;
+
+  // Busy-wait for work in the thread pool instead of sleeping
+  bool allowSpinning = true;
+  bool denormalAsZero = false;
+
+  // "default", "latency", "throughput" or "low-memory"
+  static SessionProfile fromName(const std::string& name);
+
+  // All settings as a string, e.g. for cache keys
+  std::string toKey() const;
+};
+
+// Reusable state for one synthesize call at a time: a session replica,
+// input tensors over preallocated buffers and the output of the last run.
+struct SynthesisContext
+{
+  ModelSession* session = nullptr;
+
+  std::vector<PhonemeId> phonemeIds;
+  std::array<int64_t, 1> phonemeIdLengths{};
+  std::array<float, 3> scales{};
+
+  // Views of the buffers above; phoneme id tensors are created once per sequence length
+  std::vector<Ort::Value> phonemeIdTensors;
+  Ort::Value phonemeIdLengthsTensor{nullptr};
+  Ort::Value scalesTensor{nullptr};
+
+  // Allocated by onnxruntime on every run (from its arena if the profile enables cpuMemArena).
+  // The audio length is only known after inference, and onnxruntime rejects a preallocated output of another shape,
+  // so the output can't live in a context-owned buffer; without the arena, each run allocates it.
+  Ort::Value outputTensor{nullptr};
+  std::size_t audioCount = 0;
+};
+
+// How synthesized audio is brought to full scale
+enum class AudioNormalization
+{
+  // Each phrase is scaled to its own peak, so loudness can jump between phrases
+  PhrasePeak,
+  // One gain for the whole voice followed by a soft limiter; no pass over the full utterance needed
+  FixedGain
+};
+
+struct VoiceOptions
+{
+  SessionProfile sessionProfile;
+
+  // Applied with OrtRuntime::configure before the model is loaded; only the first voice of a process can set it
+  std::optional<RuntimeConfig> runtimeConfig;
+
+  // Number of onnx sessions created for the model.
+  // Concurrent calls to synthesize are spread over them round-robin.
+  std::size_t numReplicas = 1;
+  // Save the optimized graph as an ORT format model and load it directly next time.
+  // The cache key is the model file's path, size and modification time, the onnxruntime version, the session
+  // profile and the CPU. Where the CPU is unknown (outside Linux), graphs are saved with ORT_ENABLE_EXTENDED at most,
+  // since onnxruntime doesn't optimize cached models again: ORT_ENABLE_ALL profiles then lose its layout optimizations.
+  // If the cache can't be read or written, the model is loaded as usual.
+  bool cacheOptimizedModel = false;
+
+  // Directory for optimized models (empty = next to the voice model)
+  std::string optimizedModelCacheDir;
+
+  // Replicas share one copy of the prepacked weights.
+  // ORT format models, including those from cacheOptimizedModel, also share the model bytes for their initializers;
+  // onnx models are never converted implicitly.
+  bool shareReplicaWeights = true;
+
+  // Build sessions from a memory mapping of the model file instead of reading it into the heap.
+  // ORT format models are then used in place, including their initializers.
+  bool memoryMapModel = false;
+
+  // Load the INT8 quantized variant of the model if one exists (see piper-quantize)
+  bool preferQuantized = false;
+
+  AudioNormalization normalization = AudioNormalization::PhrasePeak;
+
+  // Linear gain for FixedGain normalization.
+  // 0 = calibrate it from reference phrases when the voice is loaded (see calibrateOutputGain).
+  float outputGain = 0.0f;
+  SoftLimiterConfig limiter;
+};
+
 class Voice
 {
 public:
-  Voice(const std::string& modelPath, const std::string& modelConfigPath);
+  Voice(const std::string& modelPath,
+        const std::string& modelConfigPath,
+        const VoiceOptions& options = VoiceOptions());
   ~Voice();
 
+  // Safe to call from multiple threads at once
   void synthesize(std::vector<int16_t>& audioBuffer, std::vector<PhonemeId>& phonemeIds, SynthesisResult& result);
 
+  // Same as above, but hands the float samples to the callback without copying or converting them to int16
+  void synthesize(std::vector<PhonemeId>& phonemeIds, SynthesisResult& result, const FloatAudioCallback& audioCallback);
+
+  // Synthesizes several phoneme id sequences with as few onnx runs as possible.
+  // Sequences of similar length are padded into [B, T] batches of at most maxBatchSize rows.
+  // Batching needs the audio length of each row from the model; otherwise each sequence is synthesized
+  // on its own, with the same audio as synthesize().
+  // Audio and results are returned in the same order as the phoneme ids.
+  void synthesizeBatch(std::vector<std::vector<int16_t>>& audioBuffers,
+                       const std::vector<std::vector<PhonemeId>>& phonemeIds,
+                       std::vector<SynthesisResult>& results,
+                       std::size_t maxBatchSize = 8);
+
   std::string getLanguage() { return phonemizeConfig.eSpeakVoice; }
   std::size_t getSentenceSilenceSamples() {
     return synthesisConfig.sampleRate * synthesisConfig.sentenceSilenceSeconds;
   }
-  std::map<Phoneme, std::vector<PhonemeId>> getPhonemeIdMap() { return phonemizeConfig.phonemeIdMap; }
+  const std::map<Phoneme, std::vector<PhonemeId>>& getPhonemeIdMap() { return phonemizeConfig.phonemeIdMap; }
+
+  // Phoneme id map compiled when the voice is loaded
+  std::shared_ptr<const PhonemeIdTable> getPhonemeIdTable() { return phonemeIdTable; }
   std::optional<std::map<piper::Phoneme, float>> getPhonemeSilenceSeconds() {
     return synthesisConfig.phonemeSilenceSeconds;
   }
@@ -84,14 +213,83 @@ public:
   int getSampleWidth() { return synthesisConfig.sampleWidth; }
   int getChannels() { return synthesisConfig.channels; }
 
+  // Inference settings used for every call to synthesize
+  SynthesisConfig& getSynthesisConfig() { return synthesisConfig; }
+
+  // Where the INT8 quantized variant of a model is expected
+  static std::string getQuantizedModelPath(const std::string& modelPath);
+
+  // Content hash of the onnx model file (computed on first use).
+  // With cacheOptimizedModel, it is stored in the cache directory and only computed once per model file.
+  uint64_t getModelHash();
+
+  // Hash of the voice config, including the eSpeak voice, phoneme type and phoneme maps
+  uint64_t getConfigHash() { return configHash; }
+
+  // Gain used for FixedGain normalization
+  float getOutputGain() { return outputGain; }
+
+  // Sets the FixedGain gain so the loudest of the reference phrases peaks just under the limiter threshold.
+  // Not safe to call while synthesizing.
+  void calibrateOutputGain(std::vector<std::vector<PhonemeId>>& referencePhonemeIds);
+
 private:
   json configRoot;
+  uint64_t configHash = 0;
   PhonemizeConfig phonemizeConfig;
   SynthesisConfig synthesisConfig;
-  ModelSession session;
+  std::shared_ptr<const PhonemeIdTable> phonemeIdTable;
+  VoiceOptions voiceOptions;
+  std::string modelPath;
+  std::optional<uint64_t> modelHash;
+
+  // Shared by all replicas, so they must outlive the sessions
+  std::unique_ptr<Ort::PrepackedWeightsContainer> prepackedWeights;
+  std::vector<char> modelBytes;
+  std::vector<std::unique_ptr<MappedFile>> mappedModels;
+
+  std::vector<std::unique_ptr<ModelSession>> sessions;
+  std::atomic<std::size_t> nextSession{0};
+
+  // Idle synthesis contexts; one is created for each concurrent caller
+  Ort::MemoryInfo memoryInfo{nullptr};
+  std::mutex contextMutex;
+  std::vector<std::unique_ptr<SynthesisContext>> idleContexts;
   const float MAX_WAV_VALUE = 32767.0f;
 
+  float outputGain = 1.0f;
+  SoftLimiter limiter;
+
+  // Calibrated peak relative to the limiter threshold, leaving headroom for louder phrases
+  const float CALIBRATION_PEAK = 0.8f;
+
+  // Padding allowed in a batch, relative to the unpadded number of phoneme ids
+  const float MAX_BATCH_PADDING = 0.25f;
+
+  // Optional model output with the number of audio samples of each row, [B] int64.
+  // Piper's exports don't have it, so synthesizeBatch then runs one phrase at a time.
+  static constexpr const char* OUTPUT_LENGTHS_NAME = "output_lengths";
+  std::optional<std::string> outputLengthsName;
+
   void loadModel(const std::string& modelPath);
+  template <typename AudioHandler>
+  void infer(std::vector<PhonemeId>& phonemeIds, SynthesisResult& result, AudioHandler handleAudio);
+  void infer(std::vector<PhonemeId>& phonemeIds, SynthesisResult& result, SynthesisContext& context);
+  std::unique_ptr<SynthesisContext> acquireSynthesisContext();
+  void releaseSynthesisContext(std::unique_ptr<SynthesisContext> context);
+  void applySessionProfile(const SessionProfile& profile, Ort::SessionOptions& options);
+  std::string getModelCachePath(const std::string& extension);
+  std::string getOptimizedModelCachePath();
+  GraphOptimizationLevel getSavedOptimizationLevel();
+
+  // Optimizes the model at sourcePath with the session profile and saves it in ORT format
+  bool saveOptimizedModel(const std::string& sourcePath, const std::string& ortPath);
+  void synthesizeRows(std::vector<std::vector<int16_t>>& audioBuffers,
+                      const std::vector<std::vector<PhonemeId>>& phonemeIds,
+                      std::vector<SynthesisResult>& results,
+                      const std::vector<std::size_t>& rowIndices);
+  void convertAudio(float* audio, int64_t audioCount, std::vector<int16_t>& audioBuffer);
+  void normalizeAudio(float* audio, std::size_t audioCount);
   void parsePhonemizeConfig(json& configRoot, PhonemizeConfig& phonemizeConfig);
   void parseSynthesisConfig(json& configRoot, SynthesisConfig& synthesisConfig);
 
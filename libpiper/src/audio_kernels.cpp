@@ -0,0 +1,291 @@
+#include "audio_kernels.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define PIPER_KERNELS_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define PIPER_TARGET_AVX2
+#else
+#define PIPER_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define PIPER_KERNELS_NEON
+#include <arm_neon.h>
+#endif
+
+namespace piper {
+
+namespace {
+
+const float INT16_MIN_VALUE = static_cast<float>(std::numeric_limits<int16_t>::min());
+const float INT16_MAX_VALUE = static_cast<float>(std::numeric_limits<int16_t>::max());
+
+// ---- scalar ----
+
+float peakAbsScalar(const float* audio, std::size_t count) {
+  float peak = 0.0f;
+  for (std::size_t i = 0; i < count; i++)
+  {
+    peak = std::max(peak, std::abs(audio[i]));
+  }
+
+  return peak;
+}
+
+void scaleToInt16Scalar(const float* audio, std::size_t count, float scale, int16_t* out) {
+  for (std::size_t i = 0; i < count; i++)
+  {
+    out[i] = static_cast<int16_t>(std::clamp(audio[i] * scale, INT16_MIN_VALUE, INT16_MAX_VALUE));
+  }
+}
+
+void scaleInPlaceScalar(float* audio, std::size_t count, float scale) {
+  for (std::size_t i = 0; i < count; i++)
+  {
+    audio[i] *= scale;
+  }
+}
+
+const AudioKernels SCALAR_KERNELS = {"scalar", peakAbsScalar, scaleToInt16Scalar, scaleInPlaceScalar};
+
+#ifdef PIPER_KERNELS_X86
+
+// ---- SSE2 (x86-64 baseline) ----
+
+float peakAbsSse2(const float* audio, std::size_t count) {
+  const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+  __m128 peak0 = _mm_setzero_ps();
+  __m128 peak1 = _mm_setzero_ps();
+
+  std::size_t i = 0;
+  for (; i + 8 <= count; i += 8)
+  {
+    peak0 = _mm_max_ps(peak0, _mm_and_ps(_mm_loadu_ps(audio + i), absMask));
+    peak1 = _mm_max_ps(peak1, _mm_and_ps(_mm_loadu_ps(audio + i + 4), absMask));
+  }
+
+  // Horizontal max
+  __m128 peak = _mm_max_ps(peak0, peak1);
+  peak = _mm_max_ps(peak, _mm_shuffle_ps(peak, peak, _MM_SHUFFLE(1, 0, 3, 2)));
+  peak = _mm_max_ss(peak, _mm_shuffle_ps(peak, peak, _MM_SHUFFLE(0, 1, 0, 1)));
+
+  return std::max(_mm_cvtss_f32(peak), peakAbsScalar(audio + i, count - i));
+}
+
+void scaleToInt16Sse2(const float* audio, std::size_t count, float scale, int16_t* out) {
+  const __m128 scaleVec = _mm_set1_ps(scale);
+  const __m128 minVec = _mm_set1_ps(INT16_MIN_VALUE);
+  const __m128 maxVec = _mm_set1_ps(INT16_MAX_VALUE);
+
+  std::size_t i = 0;
+  for (; i + 8 <= count; i += 8)
+  {
+    // Clamp in float first: cvtt maps out of range values to INT32_MIN
+    __m128 low = _mm_max_ps(_mm_min_ps(_mm_mul_ps(_mm_loadu_ps(audio + i), scaleVec), maxVec), minVec);
+    __m128 high = _mm_max_ps(_mm_min_ps(_mm_mul_ps(_mm_loadu_ps(audio + i + 4), scaleVec), maxVec), minVec);
+
+    __m128i packed = _mm_packs_epi32(_mm_cvttps_epi32(low), _mm_cvttps_epi32(high));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), packed);
+  }
+
+  scaleToInt16Scalar(audio + i, count - i, scale, out + i);
+}
+
+void scaleInPlaceSse2(float* audio, std::size_t count, float scale) {
+  const __m128 scaleVec = _mm_set1_ps(scale);
+
+  std::size_t i = 0;
+  for (; i + 4 <= count; i += 4)
+  {
+    _mm_storeu_ps(audio + i, _mm_mul_ps(_mm_loadu_ps(audio + i), scaleVec));
+  }
+
+  scaleInPlaceScalar(audio + i, count - i, scale);
+}
+
+const AudioKernels SSE2_KERNELS = {"sse2", peakAbsSse2, scaleToInt16Sse2, scaleInPlaceSse2};
+
+// ---- AVX2 ----
+
+PIPER_TARGET_AVX2 float peakAbsAvx2(const float* audio, std::size_t count) {
+  const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+  __m256 peak0 = _mm256_setzero_ps();
+  __m256 peak1 = _mm256_setzero_ps();
+
+  std::size_t i = 0;
+  for (; i + 16 <= count; i += 16)
+  {
+    peak0 = _mm256_max_ps(peak0, _mm256_and_ps(_mm256_loadu_ps(audio + i), absMask));
+    peak1 = _mm256_max_ps(peak1, _mm256_and_ps(_mm256_loadu_ps(audio + i + 8), absMask));
+  }
+
+  // Horizontal max
+  __m256 peak256 = _mm256_max_ps(peak0, peak1);
+  __m128 peak = _mm_max_ps(_mm256_castps256_ps128(peak256), _mm256_extractf128_ps(peak256, 1));
+  peak = _mm_max_ps(peak, _mm_shuffle_ps(peak, peak, _MM_SHUFFLE(1, 0, 3, 2)));
+  peak = _mm_max_ss(peak, _mm_shuffle_ps(peak, peak, _MM_SHUFFLE(0, 1, 0, 1)));
+
+  return std::max(_mm_cvtss_f32(peak), peakAbsScalar(audio + i, count - i));
+}
+
+PIPER_TARGET_AVX2 void scaleToInt16Avx2(const float* audio, std::size_t count, float scale, int16_t* out) {
+  const __m256 scaleVec = _mm256_set1_ps(scale);
+  const __m256 minVec = _mm256_set1_ps(INT16_MIN_VALUE);
+  const __m256 maxVec = _mm256_set1_ps(INT16_MAX_VALUE);
+
+  std::size_t i = 0;
+  for (; i + 16 <= count; i += 16)
+  {
+    __m256 low = _mm256_max_ps(_mm256_min_ps(_mm256_mul_ps(_mm256_loadu_ps(audio + i), scaleVec), maxVec), minVec);
+    __m256 high =
+        _mm256_max_ps(_mm256_min_ps(_mm256_mul_ps(_mm256_loadu_ps(audio + i + 8), scaleVec), maxVec), minVec);
+
+    // packs works per 128-bit lane, so put the 64-bit quarters back in order
+    __m256i packed = _mm256_packs_epi32(_mm256_cvttps_epi32(low), _mm256_cvttps_epi32(high));
+    packed = _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), packed);
+  }
+
+  scaleToInt16Sse2(audio + i, count - i, scale, out + i);
+}
+
+PIPER_TARGET_AVX2 void scaleInPlaceAvx2(float* audio, std::size_t count, float scale) {
+  const __m256 scaleVec = _mm256_set1_ps(scale);
+
+  std::size_t i = 0;
+  for (; i + 8 <= count; i += 8)
+  {
+    _mm256_storeu_ps(audio + i, _mm256_mul_ps(_mm256_loadu_ps(audio + i), scaleVec));
+  }
+
+  scaleInPlaceSse2(audio + i, count - i, scale);
+}
+
+const AudioKernels AVX2_KERNELS = {"avx2", peakAbsAvx2, scaleToInt16Avx2, scaleInPlaceAvx2};
+
+bool cpuSupportsAvx2() {
+#ifdef _MSC_VER
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7)
+  {
+    return false;
+  }
+
+  // OS must save the YMM registers
+  __cpuid(info, 1);
+  bool osxsave = (info[2] & (1 << 27)) != 0;
+  if (!osxsave || ((_xgetbv(0) & 0x6) != 0x6))
+  {
+    return false;
+  }
+
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // PIPER_KERNELS_X86
+
+#ifdef PIPER_KERNELS_NEON
+
+// ---- NEON ----
+
+float peakAbsNeon(const float* audio, std::size_t count) {
+  float32x4_t peak0 = vdupq_n_f32(0.0f);
+  float32x4_t peak1 = vdupq_n_f32(0.0f);
+
+  std::size_t i = 0;
+  for (; i + 8 <= count; i += 8)
+  {
+    peak0 = vmaxq_f32(peak0, vabsq_f32(vld1q_f32(audio + i)));
+    peak1 = vmaxq_f32(peak1, vabsq_f32(vld1q_f32(audio + i + 4)));
+  }
+
+  // Horizontal max (pairwise so it works on 32-bit ARM too)
+  float32x4_t peak4 = vmaxq_f32(peak0, peak1);
+  float32x2_t peak2 = vpmax_f32(vget_low_f32(peak4), vget_high_f32(peak4));
+  peak2 = vpmax_f32(peak2, peak2);
+
+  return std::max(vget_lane_f32(peak2, 0), peakAbsScalar(audio + i, count - i));
+}
+
+void scaleToInt16Neon(const float* audio, std::size_t count, float scale, int16_t* out) {
+  const float32x4_t minVec = vdupq_n_f32(INT16_MIN_VALUE);
+  const float32x4_t maxVec = vdupq_n_f32(INT16_MAX_VALUE);
+
+  std::size_t i = 0;
+  for (; i + 8 <= count; i += 8)
+  {
+    float32x4_t low = vmaxq_f32(vminq_f32(vmulq_n_f32(vld1q_f32(audio + i), scale), maxVec), minVec);
+    float32x4_t high = vmaxq_f32(vminq_f32(vmulq_n_f32(vld1q_f32(audio + i + 4), scale), maxVec), minVec);
+
+    // vcvtq truncates toward zero like the scalar cast
+    int16x8_t packed = vcombine_s16(vqmovn_s32(vcvtq_s32_f32(low)), vqmovn_s32(vcvtq_s32_f32(high)));
+    vst1q_s16(out + i, packed);
+  }
+
+  scaleToInt16Scalar(audio + i, count - i, scale, out + i);
+}
+
+void scaleInPlaceNeon(float* audio, std::size_t count, float scale) {
+  std::size_t i = 0;
+  for (; i + 4 <= count; i += 4)
+  {
+    vst1q_f32(audio + i, vmulq_n_f32(vld1q_f32(audio + i), scale));
+  }
+
+  scaleInPlaceScalar(audio + i, count - i, scale);
+}
+
+const AudioKernels NEON_KERNELS = {"neon", peakAbsNeon, scaleToInt16Neon, scaleInPlaceNeon};
+
+#endif // PIPER_KERNELS_NEON
+
+} // namespace
+
+std::vector<const AudioKernels*> getAvailableAudioKernels() {
+  std::vector<const AudioKernels*> kernels = {&SCALAR_KERNELS};
+
+#ifdef PIPER_KERNELS_X86
+  kernels.push_back(&SSE2_KERNELS);
+  if (cpuSupportsAvx2())
+  {
+    kernels.push_back(&AVX2_KERNELS);
+  }
+#endif
+
+#ifdef PIPER_KERNELS_NEON
+  kernels.push_back(&NEON_KERNELS);
+#endif
+
+  return kernels;
+}
+
+const AudioKernels& getAudioKernels() {
+  // Last available implementation is the widest
+  static const AudioKernels& kernels = *getAvailableAudioKernels().back();
+  return kernels;
+}
+
+void normalizeToInt16(const float* audio,
+                      std::size_t count,
+                      float minPeak,
+                      float maxValue,
+                      std::vector<int16_t>& audioBuffer) {
+  const AudioKernels& kernels = getAudioKernels();
+  float peak = std::max(minPeak, kernels.peakAbs(audio, count));
+
+  std::size_t offset = audioBuffer.size();
+  audioBuffer.resize(offset + count);
+  kernels.scaleToInt16(audio, count, maxValue / peak, audioBuffer.data() + offset);
+}
+
+} // namespace piper
@@ -0,0 +1,42 @@
+#ifndef AUDIO_KERNELS_H_
+#define AUDIO_KERNELS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace piper {
+
+// Vectorized loops over synthesized float audio.
+// Implementations are picked once at runtime from what the CPU supports.
+struct AudioKernels
+{
+  const char* name;
+
+  // Largest absolute sample value (0 for empty input)
+  float (*peakAbs)(const float* audio, std::size_t count);
+
+  // out[i] = int16(audio[i] * scale), truncated and saturated
+  void (*scaleToInt16)(const float* audio, std::size_t count, float scale, int16_t* out);
+
+  // audio[i] *= scale
+  void (*scaleInPlace)(float* audio, std::size_t count, float scale);
+};
+
+// Best kernels for this CPU
+const AudioKernels& getAudioKernels();
+
+// Every implementation this CPU can run, scalar first (for benchmarks)
+std::vector<const AudioKernels*> getAvailableAudioKernels();
+
+// Peak normalize float audio to maxValue and append it to audioBuffer as int16.
+// Peaks below minPeak are treated as minPeak so silence isn't amplified.
+void normalizeToInt16(const float* audio,
+                      std::size_t count,
+                      float minPeak,
+                      float maxValue,
+                      std::vector<int16_t>& audioBuffer);
+
+} // namespace piper
+
+#endif // AUDIO_KERNELS_H_
@@ -0,0 +1,64 @@
+#ifndef HASH_H_
+#define HASH_H_
+
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace piper {
+
+// 64-bit FNV-1a, used to build cache keys (not cryptographic)
+const uint64_t FNV_OFFSET_BASIS = 0xcbf29ce484222325ULL;
+const uint64_t FNV_PRIME = 0x100000001b3ULL;
+
+inline uint64_t fnv1a(const void* data, std::size_t size, uint64_t hash = FNV_OFFSET_BASIS) {
+  auto bytes = static_cast<const uint8_t*>(data);
+  for (std::size_t i = 0; i < size; i++)
+  {
+    hash ^= bytes[i];
+    hash *= FNV_PRIME;
+  }
+
+  return hash;
+}
+
+inline uint64_t fnv1a(const std::string& str, uint64_t hash = FNV_OFFSET_BASIS) {
+  // Include the terminator so that consecutive strings can't run into each other
+  return fnv1a(str.c_str(), str.size() + 1, hash);
+}
+
+// Hash of a file's contents
+inline uint64_t fnv1aFile(const std::string& path, uint64_t hash = FNV_OFFSET_BASIS) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file)
+  {
+    throw std::runtime_error("Failed to open " + path);
+  }
+
+  std::vector<char> chunk(1 << 16);
+  while (file)
+  {
+    file.read(chunk.data(), chunk.size());
+    hash = fnv1a(chunk.data(), file.gcount(), hash);
+  }
+
+  return hash;
+}
+
+inline std::string hashToHex(uint64_t hash) {
+  const char* digits = "0123456789abcdef";
+  std::string hex(16, '0');
+  for (int i = 15; i >= 0; i--)
+  {
+    hex[i] = digits[hash & 0xF];
+    hash >>= 4;
+  }
+
+  return hex;
+}
+
+} // namespace piper
+
+#endif // HASH_H_
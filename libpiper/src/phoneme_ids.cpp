@@ -1,4 +1,7 @@
+#include <algorithm>
+#include <limits>
 #include <map>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
@@ -6,75 +9,202 @@
 
 namespace piper {
 
-void phonemes_to_ids(const std::vector<Phoneme>& phonemes,
-                     PhonemeIdConfig& config,
-                     std::vector<PhonemeId>& phonemeIds,
-                     std::map<Phoneme, std::size_t>& missingPhonemes) {
-
-  auto phonemeIdMap = std::make_shared<PhonemeIdMap>(DEFAULT_PHONEME_ID_MAP);
-  if (config.phonemeIdMap)
+PhonemeIdTable::PhonemeIdTable(const PhonemeIdMap& phonemeIdMap) {
+  if (phonemeIdMap.size() >= std::numeric_limits<std::uint16_t>::max())
   {
-    phonemeIdMap = config.phonemeIdMap;
+    throw std::runtime_error("Too many phonemes in phoneme id map");
   }
 
-  // Beginning of sentence symbol (^)
-  if (config.addBos)
+  m_entries.reserve(phonemeIdMap.size());
+  for (auto const& phonemeIds : phonemeIdMap)
   {
-    auto const bosIds = &(phonemeIdMap->at(config.bos));
-    phonemeIds.insert(phonemeIds.end(), bosIds->begin(), bosIds->end());
+    Entry entry;
+    entry.count = phonemeIds.second.size();
+    if (entry.count <= MAX_INLINE_IDS)
+    {
+      std::copy(phonemeIds.second.begin(), phonemeIds.second.end(), entry.ids.begin());
+    }
+    else
+    {
+      entry.ids[0] = m_spilledIds.size();
+      m_spilledIds.insert(m_spilledIds.end(), phonemeIds.second.begin(), phonemeIds.second.end());
+    }
+
+    m_entries.push_back(entry);
 
-    if (config.interspersePad)
+    // Map is sorted, so sparse slots are too
+    auto slot = static_cast<std::uint16_t>(m_entries.size());
+    if (phonemeIds.first < DENSE_CODEPOINTS)
     {
-      // Pad after bos (_)
-      auto const padIds = &(phonemeIdMap->at(config.pad));
-      phonemeIds.insert(phonemeIds.end(), padIds->begin(), padIds->end());
+      m_denseSlots[phonemeIds.first] = slot;
+    }
+    else
+    {
+      m_sparseSlots.emplace_back(phonemeIds.first, slot);
     }
   }
+}
+
+PhonemeIdTable::PhonemeIdTable(const PhonemeIdEntry* entries, std::size_t numEntries) {
+  if (numEntries >= std::numeric_limits<std::uint16_t>::max())
+  {
+    throw std::runtime_error("Too many phonemes in phoneme id table");
+  }
 
-  if (config.interspersePad)
+  m_entries.reserve(numEntries);
+  for (std::size_t i = 0; i < numEntries; i++)
   {
-    // Add ids for each phoneme *with* padding
-    auto const padIds = &(phonemeIdMap->at(config.pad));
+    Entry entry;
+    entry.ids[0] = entries[i].id;
+    entry.count = 1;
+    m_entries.push_back(entry);
 
-    for (auto const phoneme : phonemes)
+    auto slot = static_cast<std::uint16_t>(m_entries.size());
+    if (entries[i].phoneme < DENSE_CODEPOINTS)
+    {
+      m_denseSlots[entries[i].phoneme] = slot;
+    }
+    else
     {
-      if (phonemeIdMap->count(phoneme) < 1)
-      {
-        // Phoneme is missing from id map
-        if (missingPhonemes.count(phoneme) < 1)
-        {
-          missingPhonemes[phoneme] = 1;
-        }
-        else
-        {
-          missingPhonemes[phoneme] += 1;
-        }
-
-        continue;
-      }
-
-      auto const mappedIds = &(phonemeIdMap->at(phoneme));
-      phonemeIds.insert(phonemeIds.end(), mappedIds->begin(), mappedIds->end());
+      m_sparseSlots.emplace_back(entries[i].phoneme, slot);
+    }
+  }
+}
 
-      // pad (_)
-      phonemeIds.insert(phonemeIds.end(), padIds->begin(), padIds->end());
+std::uint16_t PhonemeIdTable::findSparseSlot(Phoneme phoneme) const {
+  auto it = std::lower_bound(m_sparseSlots.begin(),
+                             m_sparseSlots.end(),
+                             phoneme,
+                             [](const std::pair<Phoneme, std::uint16_t>& slot, Phoneme p) { return slot.first < p; });
+
+  if ((it == m_sparseSlots.end()) || (it->first != phoneme))
+  {
+    return 0;
+  }
+
+  return it->second;
+}
+
+PhonemeIdSpan PhonemeIdTable::at(Phoneme phoneme) const {
+  PhonemeIdSpan span = find(phoneme);
+  if (span.ids == nullptr)
+  {
+    throw std::out_of_range("Phoneme is not in phoneme id map");
+  }
+
+  return span;
+}
+
+const PhonemeIdTable& getDefaultPhonemeIdTable() {
+  static const PhonemeIdTable defaultTable(DEFAULT_PHONEME_ID_MAP.data(), DEFAULT_PHONEME_ID_MAP.size());
+  return defaultTable;
+}
+
+namespace {
+
+// One variant per combination of flags, so the phoneme loop has no branches on the config
+template <bool InterspersePad, bool AddBos, bool AddEos>
+void appendPhonemeIds(const std::vector<Phoneme>& phonemes,
+                      const PhonemeIdTable& table,
+                      const PhonemeIdConfig& config,
+                      std::vector<PhonemeId>& phonemeIds,
+                      std::map<Phoneme, std::size_t>& missingPhonemes) {
+  PhonemeIdSpan padIds;
+  if constexpr (InterspersePad)
+  {
+    padIds = table.at(config.pad);
+  }
+
+  // Most phonemes have a single id
+  phonemeIds.reserve(phonemeIds.size() + (phonemes.size() * (InterspersePad ? 2 : 1)) + 4);
+
+  // Beginning of sentence symbol (^)
+  if constexpr (AddBos)
+  {
+    PhonemeIdSpan bosIds = table.at(config.bos);
+    phonemeIds.insert(phonemeIds.end(), bosIds.ids, bosIds.ids + bosIds.count);
+
+    if constexpr (InterspersePad)
+    {
+      // Pad after bos (_)
+      phonemeIds.insert(phonemeIds.end(), padIds.ids, padIds.ids + padIds.count);
     }
   }
-  else
+
+  for (auto const phoneme : phonemes)
   {
-    // Add ids for each phoneme *without* padding
-    for (auto const phoneme : phonemes)
+    PhonemeIdSpan mappedIds = table.find(phoneme);
+    if (mappedIds.ids == nullptr)
+    {
+      // Phoneme is missing from id map
+      missingPhonemes[phoneme] += 1;
+      continue;
+    }
+
+    phonemeIds.insert(phonemeIds.end(), mappedIds.ids, mappedIds.ids + mappedIds.count);
+
+    if constexpr (InterspersePad)
     {
-      auto const mappedIds = &(phonemeIdMap->at(phoneme));
-      phonemeIds.insert(phonemeIds.end(), mappedIds->begin(), mappedIds->end());
+      // pad (_)
+      phonemeIds.insert(phonemeIds.end(), padIds.ids, padIds.ids + padIds.count);
     }
   }
 
   // End of sentence symbol ($)
-  if (config.addEos)
+  if constexpr (AddEos)
+  {
+    PhonemeIdSpan eosIds = table.at(config.eos);
+    phonemeIds.insert(phonemeIds.end(), eosIds.ids, eosIds.ids + eosIds.count);
+  }
+}
+
+} // namespace
+
+void phonemes_to_ids(const std::vector<Phoneme>& phonemes,
+                     PhonemeIdConfig& config,
+                     std::vector<PhonemeId>& phonemeIds,
+                     std::map<Phoneme, std::size_t>& missingPhonemes) {
+  // Compile the map once and keep the table in the config; a table set by the caller wins
+  bool ownTable = !config.phonemeIdTable || config.compiledPhonemeIdMap;
+  if (config.phonemeIdMap && ownTable && (config.compiledPhonemeIdMap != config.phonemeIdMap))
+  {
+    config.phonemeIdTable = std::make_shared<PhonemeIdTable>(*config.phonemeIdMap);
+    config.compiledPhonemeIdMap = config.phonemeIdMap;
+  }
+
+  const PhonemeIdTable* table = &getDefaultPhonemeIdTable();
+  if (config.phonemeIdTable)
+  {
+    table = config.phonemeIdTable.get();
+  }
+
+  int variant = (config.interspersePad ? 4 : 0) | (config.addBos ? 2 : 0) | (config.addEos ? 1 : 0);
+  switch (variant)
   {
-    auto const eosIds = &(phonemeIdMap->at(config.eos));
-    phonemeIds.insert(phonemeIds.end(), eosIds->begin(), eosIds->end());
+  case 0:
+    appendPhonemeIds<false, false, false>(phonemes, *table, config, phonemeIds, missingPhonemes);
+    break;
+  case 1:
+    appendPhonemeIds<false, false, true>(phonemes, *table, config, phonemeIds, missingPhonemes);
+    break;
+  case 2:
+    appendPhonemeIds<false, true, false>(phonemes, *table, config, phonemeIds, missingPhonemes);
+    break;
+  case 3:
+    appendPhonemeIds<false, true, true>(phonemes, *table, config, phonemeIds, missingPhonemes);
+    break;
+  case 4:
+    appendPhonemeIds<true, false, false>(phonemes, *table, config, phonemeIds, missingPhonemes);
+    break;
+  case 5:
+    appendPhonemeIds<true, false, true>(phonemes, *table, config, phonemeIds, missingPhonemes);
+    break;
+  case 6:
+    appendPhonemeIds<true, true, false>(phonemes, *table, config, phonemeIds, missingPhonemes);
+    break;
+  default:
+    appendPhonemeIds<true, true, true>(phonemes, *table, config, phonemeIds, missingPhonemes);
+    break;
   }
 }
 
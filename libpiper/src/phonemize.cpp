@@ -1,36 +1,228 @@
+#include <algorithm>
+#include <atomic>
+#include <iterator>
 #include <map>
+#include <numeric>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include <espeak-ng/speak_lib.h>
 
+#include "hash.hpp"
 #include "phonemize.hpp"
 #include "uni_algo.h"
 
 namespace piper {
 
-// language -> phoneme -> [phoneme, ...]
-std::map<std::string, PhonemeMap> DEFAULT_PHONEME_MAP = {{"pt-br", {{U'c', {U'k'}}}}};
+namespace {
 
-void phonemize_eSpeak(const std::string& text,
-                      eSpeakPhonemeConfig& config,
-                      std::vector<std::vector<Phoneme>>& phonemes) {
+// Voice last passed to espeak_SetVoiceByName; only touched by the thread that owns eSpeak
+std::string selectedVoice;
+
+std::atomic<uint64_t> numVoiceSelections{0};
+std::atomic<uint64_t> numVoiceSwitches{0};
+
+struct PhonemeMapping
+{
+  std::string_view voice;
+  Phoneme from;
+  std::u32string_view to;
+};
 
-  if (espeak_SetVoiceByName(config.voice.c_str()) != EE_OK)
+constexpr bool operator<(const PhonemeMapping& a, const PhonemeMapping& b) {
+  return (a.voice < b.voice) || ((a.voice == b.voice) && (a.from < b.from));
+}
+
+// voice -> phoneme -> [phoneme, ...], sorted by voice and phoneme
+constexpr PhonemeMapping DEFAULT_PHONEME_MAP[] = {
+    {"pt-br", U'c', U"k"},
+};
+
+constexpr bool isSorted(const PhonemeMapping* mappings, std::size_t numMappings) {
+  for (std::size_t i = 1; i < numMappings; i++)
   {
-    throw std::runtime_error("Failed to set eSpeak-ng voice");
+    if (!(mappings[i - 1] < mappings[i]))
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static_assert(isSorted(DEFAULT_PHONEME_MAP, std::size(DEFAULT_PHONEME_MAP)), "DEFAULT_PHONEME_MAP must be sorted");
+
+// Built-in mappings of one voice (empty range if it has none)
+std::pair<const PhonemeMapping*, const PhonemeMapping*> getDefaultPhonemeMappings(const std::string& voice) {
+  auto first = std::lower_bound(std::begin(DEFAULT_PHONEME_MAP),
+                                std::end(DEFAULT_PHONEME_MAP),
+                                voice,
+                                [](const PhonemeMapping& mapping, const std::string& v) { return mapping.voice < v; });
+  auto last = std::upper_bound(first,
+                               std::end(DEFAULT_PHONEME_MAP),
+                               voice,
+                               [](const std::string& v, const PhonemeMapping& mapping) { return v < mapping.voice; });
+
+  return {first, last};
+}
+
+// Fixed cost of a cache entry on top of its key and phonemes
+const std::size_t PHONEME_CACHE_ENTRY_OVERHEAD = 128;
+
+// Clause ends tried when looking up the clause at one position
+const std::size_t MAX_CLAUSE_END_CANDIDATES = 8;
+
+bool isClauseTerminator(char c) {
+  return (c == '.') || (c == ',') || (c == '?') || (c == '!') || (c == ':') || (c == ';') || (c == '\n');
+}
+
+bool isClauseSpace(char c) { return (c == ' ') || (c == '\t') || (c == '\n') || (c == '\r'); }
+
+// Where eSpeak may end a clause that starts at start: after a terminator and each whitespace following it,
+// after a full-width terminator, and at the end of the text. Wrong guesses only cost a cache lookup.
+std::vector<std::size_t> getClauseEndCandidates(const std::string& text, std::size_t start) {
+  static const std::string FULL_WIDTH_TERMINATORS[] = {"\u3002", "\uFF1F", "\uFF01", "\uFF0C", "\uFF1A", "\uFF1B"};
+
+  std::vector<std::size_t> candidates;
+  bool afterTerminator = false;
+  for (std::size_t i = start; (i < text.size()) && (candidates.size() < MAX_CLAUSE_END_CANDIDATES - 1); i++)
+  {
+    char c = text[i];
+    if (afterTerminator && isClauseSpace(c))
+    {
+      candidates.push_back(i + 1);
+    }
+    else if (isClauseTerminator(c))
+    {
+      afterTerminator = true;
+      if ((i + 1 < text.size()) && isClauseSpace(text[i + 1]))
+      {
+        candidates.push_back(i + 1);
+      }
+    }
+    else if (afterTerminator && ((c == '"') || (c == '\'') || (c == ')') || (c == ']')))
+    {
+      // Closing quotes and brackets belong to the clause
+    }
+    else
+    {
+      afterTerminator = false;
+      for (const std::string& terminator : FULL_WIDTH_TERMINATORS)
+      {
+        if (text.compare(i, terminator.size(), terminator) == 0)
+        {
+          i += terminator.size() - 1;
+          candidates.push_back(i + 1);
+          afterTerminator = true;
+          break;
+        }
+      }
+    }
   }
-  std::shared_ptr<PhonemeMap> phonemeMap;
 
+  if (candidates.empty() || (candidates.back() != text.size()))
+  {
+    candidates.push_back(text.size());
+  }
+
+  return candidates;
+}
+
+// Every setting that changes the phonemes of a clause
+std::string getPhonemeCacheKeyPrefix(const eSpeakPhonemeConfig& config) {
+  uint64_t phonemeMapHash = FNV_OFFSET_BASIS;
   if (config.phonemeMap)
   {
-    phonemeMap = config.phonemeMap;
+    for (auto const& mapping : *config.phonemeMap)
+    {
+      uint64_t numPhonemes = mapping.second.size();
+      phonemeMapHash = fnv1a(&mapping.first, sizeof(Phoneme), phonemeMapHash);
+      phonemeMapHash = fnv1a(&numPhonemes, sizeof(numPhonemes), phonemeMapHash);
+      phonemeMapHash = fnv1a(mapping.second.data(), mapping.second.size() * sizeof(Phoneme), phonemeMapHash);
+    }
+  }
+
+  const Phoneme punctuation[] = {
+      config.period, config.comma, config.question, config.exclamation, config.colon, config.semicolon, config.space};
+
+  std::string keyPrefix = config.voice;
+  keyPrefix.push_back('\0');
+  keyPrefix += hashToHex(phonemeMapHash);
+  keyPrefix.append(reinterpret_cast<const char*>(punctuation), sizeof(punctuation));
+  keyPrefix.push_back(config.keepLanguageFlags ? '1' : '0');
+
+  return keyPrefix;
+}
+
+// Prefix, then the clause's text and what follows it up to the next non-space character.
+// eSpeak skips blanks at the start of a clause, so they are not part of the key.
+std::string getPhonemeCacheKey(const std::string& keyPrefix,
+                               const std::string& text,
+                               std::size_t clauseStart,
+                               std::size_t clauseEnd) {
+  while ((clauseStart < clauseEnd) && ((text[clauseStart] == ' ') || (text[clauseStart] == '\t')))
+  {
+    clauseStart++;
   }
-  if (DEFAULT_PHONEME_MAP.find(config.voice) != DEFAULT_PHONEME_MAP.end())
+
+  std::size_t lookaheadEnd = clauseEnd;
+  while ((lookaheadEnd < text.size()) && isClauseSpace(text[lookaheadEnd]))
   {
-    phonemeMap = std::make_shared<PhonemeMap>(DEFAULT_PHONEME_MAP[config.voice]);
+    lookaheadEnd++;
   }
 
+  if (lookaheadEnd < text.size())
+  {
+    // Whole UTF-8 character
+    lookaheadEnd++;
+    while ((lookaheadEnd < text.size()) && ((text[lookaheadEnd] & 0xC0) == 0x80))
+    {
+      lookaheadEnd++;
+    }
+  }
+
+  std::string key = keyPrefix;
+  key += std::to_string(clauseEnd - clauseStart);
+  key.push_back(':');
+  key.append(text, clauseStart, lookaheadEnd - clauseStart);
+
+  return key;
+}
+
+// Cached phonemes of the clause at clauseStart, or nullptr; sets clauseEnd on a hit
+std::shared_ptr<const std::vector<Phoneme>> findCachedClause(PhonemeCache& cache,
+                                                             const std::string& keyPrefix,
+                                                             const std::string& text,
+                                                             std::size_t clauseStart,
+                                                             std::size_t& clauseEnd) {
+  std::vector<std::size_t> candidates = getClauseEndCandidates(text, clauseStart);
+  for (std::size_t candidateIdx = 0; candidateIdx < candidates.size(); candidateIdx++)
+  {
+    bool last = (candidateIdx + 1 == candidates.size());
+    auto phonemes = cache.get(getPhonemeCacheKey(keyPrefix, text, clauseStart, candidates[candidateIdx]), last);
+    if (phonemes)
+    {
+      clauseEnd = candidates[candidateIdx];
+      return phonemes;
+    }
+  }
+
+  return nullptr;
+}
+
+} // namespace
+
+void phonemizeUncached_eSpeak(const std::string& text,
+                              eSpeakPhonemeConfig& config,
+                              const ClauseSpanCallback& clauseCallback) {
+  selectESpeakVoice(config.voice);
+  std::shared_ptr<PhonemeMap> phonemeMap = config.phonemeMap;
+
+  // Built-in mappings take precedence over the config
+  auto defaultMappings = getDefaultPhonemeMappings(config.voice);
+  bool useDefaultMappings = (defaultMappings.first != defaultMappings.second);
+
   std::string textCopy = text;
 
   // std::vector<Phoneme>* sentencePhonemes = nullptr;
@@ -39,6 +231,7 @@ void phonemize_eSpeak(const std::string& text,
 
   while (inputTextPointer)
   {
+    const char* clauseStart = inputTextPointer;
     std::string clausePhonemes =
         espeak_TextToPhonemesWithTerminator((const void**) &inputTextPointer, espeakCHARS_AUTO, 0x02, &terminator);
     auto phonemesNorm = una::norm::to_nfd_utf8(clausePhonemes);
@@ -46,17 +239,181 @@ void phonemize_eSpeak(const std::string& text,
 
     for (const auto& phoneme : una::ranges::utf8_view{phonemesNorm})
     {
-      auto it = phonemeMap && phonemeMap->find(phoneme) != phonemeMap->end() ? phonemeMap->at(phoneme)
-                                                                             : std::vector<Phoneme>{phoneme};
-      if (!config.keepLanguageFlags || (phoneme != U'(' && phoneme != U')'))
+      if (config.keepLanguageFlags && ((phoneme == U'(') || (phoneme == U')')))
+      {
+        continue;
+      }
+
+      if (useDefaultMappings)
+      {
+        auto mapping = std::lower_bound(
+            defaultMappings.first, defaultMappings.second, phoneme, [](const PhonemeMapping& m, Phoneme p) {
+              return m.from < p;
+            });
+
+        if ((mapping != defaultMappings.second) && (mapping->from == phoneme))
+        {
+          sentencePhonemes.insert(sentencePhonemes.end(), mapping->to.begin(), mapping->to.end());
+          continue;
+        }
+      }
+      else if (phonemeMap)
       {
-        sentencePhonemes.insert(end(sentencePhonemes), begin(it), end(it));
+        auto mapped = phonemeMap->find(phoneme);
+        if (mapped != phonemeMap->end())
+        {
+          sentencePhonemes.insert(sentencePhonemes.end(), mapped->second.begin(), mapped->second.end());
+          continue;
+        }
       }
+
+      sentencePhonemes.push_back(phoneme);
     }
 
     addPunctuation(sentencePhonemes, terminator, config);
 
+    // eSpeak sets the pointer to null after the last clause
+    const char* clauseEnd = inputTextPointer ? inputTextPointer : (textCopy.c_str() + textCopy.size());
+    if (!clauseCallback(sentencePhonemes, clauseEnd - clauseStart))
+    {
+      break;
+    }
+  }
+}
+
+void phonemize_eSpeak(const std::string& text,
+                      eSpeakPhonemeConfig& config,
+                      std::vector<std::vector<Phoneme>>& phonemes) {
+  phonemize_eSpeak(text, config, [&phonemes](std::vector<Phoneme>& sentencePhonemes) {
     phonemes.push_back(std::move(sentencePhonemes));
+    return true;
+  });
+}
+
+void phonemizeBatch_eSpeak(std::vector<PhonemizeRequest>& requests,
+                           std::vector<std::vector<std::vector<Phoneme>>>& phonemes) {
+  phonemes.clear();
+  phonemes.resize(requests.size());
+
+  // Texts of the selected voice go first, then one group per voice in order of the voice names
+  std::vector<std::size_t> order(requests.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&requests](std::size_t a, std::size_t b) {
+    const std::string& voiceA = requests[a].config.voice;
+    const std::string& voiceB = requests[b].config.voice;
+    bool selectedA = (voiceA == selectedVoice);
+    bool selectedB = (voiceB == selectedVoice);
+
+    return (selectedA != selectedB) ? selectedA : (voiceA < voiceB);
+  });
+
+  for (std::size_t requestIdx : order)
+  {
+    phonemize_eSpeak(requests[requestIdx].text, requests[requestIdx].config, phonemes[requestIdx]);
+  }
+}
+
+void selectESpeakVoice(const std::string& voice) {
+  numVoiceSelections++;
+  if (voice == selectedVoice)
+  {
+    return;
+  }
+
+  // Clears the selection if eSpeak rejects the voice, since it may be half-loaded
+  selectedVoice.clear();
+  if (espeak_SetVoiceByName(voice.c_str()) != EE_OK)
+  {
+    throw std::runtime_error("Failed to set eSpeak-ng voice");
+  }
+
+  selectedVoice = voice;
+  numVoiceSwitches++;
+}
+
+void resetESpeakVoice() { selectedVoice.clear(); }
+
+VoiceSwitchStats getVoiceSwitchStats() {
+  VoiceSwitchStats stats;
+  stats.selections = numVoiceSelections;
+  stats.switches = numVoiceSwitches;
+
+  return stats;
+}
+
+void phonemize_eSpeak(const std::string& text, eSpeakPhonemeConfig& config, const ClauseCallback& clauseCallback) {
+  phonemizeWithCache(text, config, clauseCallback, phonemizeUncached_eSpeak);
+}
+
+void phonemizeWithCache(const std::string& text,
+                        eSpeakPhonemeConfig& config,
+                        const ClauseCallback& clauseCallback,
+                        const Phonemizer& phonemizer) {
+  if (!config.cache || text.empty())
+  {
+    phonemizer(text, config, [&clauseCallback](std::vector<Phoneme>& sentencePhonemes, std::size_t) {
+      return clauseCallback(sentencePhonemes);
+    });
+
+    return;
+  }
+
+  PhonemeCache& cache = *config.cache;
+  std::string keyPrefix = getPhonemeCacheKeyPrefix(config);
+
+  std::size_t clauseStart = 0;
+  std::size_t cachedEnd = 0;
+  auto cachedPhonemes = findCachedClause(cache, keyPrefix, text, clauseStart, cachedEnd);
+  while (clauseStart < text.size())
+  {
+    if (cachedPhonemes)
+    {
+      // The callback may take the phonemes
+      std::vector<Phoneme> sentencePhonemes = *cachedPhonemes;
+      if (!clauseCallback(sentencePhonemes))
+      {
+        return;
+      }
+
+      clauseStart = cachedEnd;
+      cachedPhonemes = nullptr;
+      if (clauseStart < text.size())
+      {
+        cachedPhonemes = findCachedClause(cache, keyPrefix, text, clauseStart, cachedEnd);
+      }
+
+      continue;
+    }
+
+    // eSpeak continues from clauseStart exactly as it would have in the whole text
+    bool stopped = false;
+    phonemizer(text.substr(clauseStart), config, [&](std::vector<Phoneme>& sentencePhonemes, std::size_t textBytes) {
+      std::size_t clauseEnd = std::min(clauseStart + textBytes, text.size());
+      std::string key = getPhonemeCacheKey(keyPrefix, text, clauseStart, clauseEnd);
+      std::size_t bytes = PHONEME_CACHE_ENTRY_OVERHEAD + key.size() + (sentencePhonemes.size() * sizeof(Phoneme));
+      cache.put(key, std::make_shared<const std::vector<Phoneme>>(sentencePhonemes), bytes);
+
+      if (!clauseCallback(sentencePhonemes))
+      {
+        stopped = true;
+        return false;
+      }
+
+      clauseStart = clauseEnd;
+      if (clauseStart < text.size())
+      {
+        cachedPhonemes = findCachedClause(cache, keyPrefix, text, clauseStart, cachedEnd);
+      }
+
+      // Replay the cached clause instead
+      return !cachedPhonemes;
+    });
+
+    if (stopped || !cachedPhonemes)
+    {
+      // Stopped by the callback or reached the end of the text
+      return;
+    }
   }
 }
 
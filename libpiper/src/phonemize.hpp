@@ -1,11 +1,15 @@
 #ifndef PHOEMIZE_H_
 #define PHOEMIZE_H_
 
+#include <cstdint>
+#include <functional>
 #include <map>
 #include <memory>
 #include <string>
 #include <vector>
 
+#include "LruCache.hpp"
+
 #define CLAUSE_INTONATION_FULL_STOP 0x00000000
 #define CLAUSE_INTONATION_COMMA 0x00001000
 #define CLAUSE_INTONATION_QUESTION 0x00002000
@@ -26,6 +30,11 @@ namespace piper {
 typedef char32_t Phoneme;
 typedef std::map<Phoneme, std::vector<Phoneme>> PhonemeMap;
 
+// Phonemes of single clauses, so a clause is reused in any text that contains it.
+// Keys cover the text eSpeak read for the clause, the character after it (eSpeak looks ahead to end a clause)
+// and every setting that changes its phonemes (voice, phoneme map, punctuation).
+typedef LruCache<std::string, std::vector<Phoneme>> PhonemeCache;
+
 struct eSpeakPhonemeConfig
 {
   std::string voice = "en-us";
@@ -42,6 +51,31 @@ struct eSpeakPhonemeConfig
   bool keepLanguageFlags = false;
 
   std::shared_ptr<PhonemeMap> phonemeMap;
+
+  // Skips eSpeak for clauses that were phonemized before (optional)
+  std::shared_ptr<PhonemeCache> cache;
+};
+
+// Receives one clause's phonemes; returns false to stop
+typedef std::function<bool(std::vector<Phoneme>&)> ClauseCallback;
+
+// Receives one clause's phonemes and the number of bytes of text eSpeak read for it; returns false to stop
+typedef std::function<bool(std::vector<Phoneme>&, std::size_t)> ClauseSpanCallback;
+
+// Anything with the contract of phonemizeUncached_eSpeak, e.g. a PhonemizerPool worker
+typedef std::function<void(const std::string&, eSpeakPhonemeConfig&, const ClauseSpanCallback&)> Phonemizer;
+
+struct PhonemizeRequest
+{
+  std::string text;
+  eSpeakPhonemeConfig config;
+};
+
+// Counts calls that needed a voice and how many of them made eSpeak load a different one
+struct VoiceSwitchStats
+{
+  uint64_t selections = 0;
+  uint64_t switches = 0;
 };
 
 // Phonemizes text using espeak-ng.
@@ -52,6 +86,44 @@ void phonemize_eSpeak(const std::string& text,
                       eSpeakPhonemeConfig& config,
                       std::vector<std::vector<Phoneme>>& phonemes);
 
+// Phonemizes text using espeak-ng, one clause at a time.
+// The callback receives each clause's phonemes as soon as eSpeak returns them
+// and may return false to stop phonemizing the rest of the text.
+//
+// Assumes espeak_Initialize has already been called and no other thread uses eSpeak.
+// ESpeakService shares eSpeak safely between models.
+void phonemize_eSpeak(const std::string& text,
+                      eSpeakPhonemeConfig& config,
+                      const ClauseCallback& clauseCallback);
+
+// Phonemizes many texts, grouped by voice so each voice is loaded at most once.
+// phonemes[i] holds the clauses of requests[i].
+//
+// Same assumptions as phonemize_eSpeak; ESpeakService::phonemizeBatch runs a batch on the shared eSpeak.
+void phonemizeBatch_eSpeak(std::vector<PhonemizeRequest>& requests,
+                           std::vector<std::vector<std::vector<Phoneme>>>& phonemes);
+
+// Calls espeak_SetVoiceByName unless the voice is already selected, which reloads its dictionaries
+void selectESpeakVoice(const std::string& voice);
+
+// Forgets the selected voice; call after espeak_Initialize
+void resetESpeakVoice();
+
+// Voice selections of this process
+VoiceSwitchStats getVoiceSwitchStats();
+
+// Same as phonemize_eSpeak, but ignores config.cache and reports how much of the text each clause took
+void phonemizeUncached_eSpeak(const std::string& text,
+                              eSpeakPhonemeConfig& config,
+                              const ClauseSpanCallback& clauseCallback);
+
+// Serves clauses from config.cache if set, and runs the phonemizer from the first clause that isn't cached.
+// The phonemizer stops as soon as the rest of the text starts with a cached clause again.
+void phonemizeWithCache(const std::string& text,
+                        eSpeakPhonemeConfig& config,
+                        const ClauseCallback& clauseCallback,
+                        const Phonemizer& phonemizer);
+
 void addPunctuation(std::vector<Phoneme>& sentencePhonemes, int terminator, const eSpeakPhonemeConfig& config);
 
 } // namespace piper
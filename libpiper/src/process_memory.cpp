@@ -0,0 +1,44 @@
+#include "process_memory.hpp"
+
+#ifdef _WIN32
+#include <windows.h>
+
+#include <psapi.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#else
+#include <fstream>
+#include <unistd.h>
+#endif
+
+namespace piper {
+
+std::size_t getResidentMemoryBytes() {
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS counters;
+  if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+  {
+    return counters.WorkingSetSize;
+  }
+#elif defined(__APPLE__)
+  mach_task_basic_info_data_t info;
+  mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+  if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t) &info, &count) == KERN_SUCCESS)
+  {
+    return info.resident_size;
+  }
+#else
+  // Total and resident pages
+  std::ifstream statm("/proc/self/statm");
+  std::size_t totalPages = 0;
+  std::size_t residentPages = 0;
+  if (statm >> totalPages >> residentPages)
+  {
+    return residentPages * sysconf(_SC_PAGESIZE);
+  }
+#endif
+
+  return 0;
+}
+
+} // namespace piper
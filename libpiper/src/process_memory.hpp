@@ -0,0 +1,13 @@
+#ifndef PROCESS_MEMORY_H_
+#define PROCESS_MEMORY_H_
+
+#include <cstddef>
+
+namespace piper {
+
+// Resident set size of the current process in bytes (0 if unavailable)
+std::size_t getResidentMemoryBytes();
+
+} // namespace piper
+
+#endif // PROCESS_MEMORY_H_
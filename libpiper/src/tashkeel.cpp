@@ -6,6 +6,7 @@
 #include <string>
 #include <vector>
 
+#include "OrtRuntime.hpp"
 #include "tashkeel.hpp"
 #include "uni_algo.h"
 #include <onnxruntime_cxx_api.h>
@@ -75,9 +76,8 @@ std::set<char32_t> HARAKAT_CHARS{
 std::set<int> INVALID_HARAKA_IDS{UNK_ID, 8};
 
 void tashkeel_load(std::string modelPath, State& state) {
-  state.env = Ort::Env(OrtLoggingLevel::ORT_LOGGING_LEVEL_WARNING, instanceName.c_str());
-  state.env.DisableTelemetryEvents();
   state.options.SetExecutionMode(ExecutionMode::ORT_PARALLEL);
+  piper::OrtRuntime::prepareSessionOptions(state.options);
 
 #ifdef _WIN32
   auto modelPathW = std::wstring(modelPath.begin(), modelPath.end());
@@ -86,7 +86,7 @@ void tashkeel_load(std::string modelPath, State& state) {
   auto modelPathStr = modelPath.c_str();
 #endif
 
-  state.onnx = Ort::Session(state.env, modelPathStr, state.options);
+  state.onnx = Ort::Session(piper::OrtRuntime::getEnv(), modelPathStr, state.options);
 }
 
 std::string tashkeel_run(std::string text, State& state) {
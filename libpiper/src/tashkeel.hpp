@@ -10,7 +10,6 @@
 // https://github.com/mush42/libtashkeel
 namespace tashkeel {
 
-const std::string instanceName = "piper_tashkeel";
 const int PAD_ID = 0;
 const int UNK_ID = 1;
 const std::size_t MAX_INPUT_CHARS = 315;
@@ -25,7 +24,6 @@ struct State
   Ort::Session onnx;
   Ort::AllocatorWithDefaultOptions allocator;
   Ort::SessionOptions options;
-  Ort::Env env;
 
   State() : onnx(nullptr){};
 };